@@ -0,0 +1,314 @@
+#include <set>
+#include <stdio.h>
+#include "aot.h"
+#include "object.h"
+
+//常量在函数开头物化一次，数字用%a保证精确
+static void emitConstantValue(Value value, std::ostream& out){
+    char buffer[64];
+    switch(value.type){
+        case VAL_BOOL: out<<"BOOL_VAL("<<(AS_BOOL(value) ? "true" : "false")<<")"; break;
+        case VAL_NIL: out<<"NIL_VAL"; break;
+        case VAL_NUMBER:
+            snprintf(buffer, sizeof(buffer), "%a", AS_NUMBER(value));
+            out<<"NUMBER_VAL("<<buffer<<")";
+            break;
+        case VAL_INT: out<<"INT_VAL("<<AS_INT(value)<<")"; break;
+        case VAL_OBJ: {
+            if(IS_MAP(value)){
+                //switch的分支表，键和下标依次传给rt.caseTable
+                const ObjMap* map = AS_MAP(value);
+                out<<"rt.caseTable({";
+                const char* separator = "";
+                for(size_t i = 0; i < map->m_ctrl.size(); i++){
+                    if(map->m_ctrl[i] < 0) continue;
+                    out<<separator;
+                    emitConstantValue(map->m_entries[i].key, out);
+                    out<<", ";
+                    emitConstantValue(map->m_entries[i].value, out);
+                    separator = ", ";
+                }
+                out<<"})";
+                break;
+            }
+            std::string_view s = AS_CSTRING(value);
+            out<<"rt.string(\"";
+            for(unsigned char c : s){
+                if(c == '"' || c == '\\' || c == '?'){
+                    out<<'\\'<<c;
+                }else if(c < 0x20 || c >= 0x7f){
+                    snprintf(buffer, sizeof(buffer), "\\%03o", c);
+                    out<<buffer;
+                }else{
+                    out<<c;
+                }
+            }
+            out<<"\", "<<s.size()<<")";
+            break;
+        }
+    }
+}
+
+static int jumpTarget(const Chunk& chunk, int offset, int sign){
+    uint16_t jump = (uint16_t)(chunk.getCode(offset + 1) << 8);
+    jump |= chunk.getCode(offset + 2);
+    return offset + 3 + sign * jump;
+}
+
+//第一遍：找出所有跳转目标(只给它们生成标签)和用到的常量
+static bool collect(const Chunk& chunk, std::set<int>* targets, std::set<int>* constants){
+    for(int offset = 0; offset < chunk.getCount();){
+        switch(chunk.getCode(offset)){
+            case OP_CONSTANT:
+            case OP_GET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_SET_GLOBAL:
+                constants->insert(chunk.getCode(offset + 1));
+                offset += 2;
+                break;
+            case OP_CONSTANT_LONG:
+            case OP_GET_GLOBAL_LONG:
+            case OP_DEFINE_GLOBAL_LONG:
+            case OP_SET_GLOBAL_LONG:
+                constants->insert(chunk.getLong(offset + 1));
+                offset += 4;
+                break;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_CALL:
+            case OP_MAP:
+                offset += 2;
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+                targets->insert(jumpTarget(chunk, offset, 1));
+                offset += 3;
+                break;
+            case OP_LOOP:
+                targets->insert(jumpTarget(chunk, offset, -1));
+                offset += 3;
+                break;
+            case OP_FOR_TEST:
+                if(!(chunk.getCode(offset + 2) & FOR_LIMIT_LOCAL)){
+                    constants->insert(chunk.getCode(offset + 3));
+                }
+                targets->insert(jumpTarget(chunk, offset + 3, 1));
+                offset += 6;
+                break;
+            case OP_FOR_STEP:
+                constants->insert(chunk.getCode(offset + 3));
+                targets->insert(jumpTarget(chunk, offset + 3, -1));
+                offset += 6;
+                break;
+            case OP_JUMP_TABLE:
+            case OP_CASE_TABLE: {
+                const uint8_t* code = chunk.getFirstCode();
+                if(code[offset] == OP_CASE_TABLE) constants->insert(chunk.getLong(offset + 3));
+                for(int entry = 0; entry <= switchCount(code, offset); entry++){
+                    targets->insert(switchTarget(code, offset, entry));
+                }
+                offset += switchLength(code, offset);
+                break;
+            }
+            case OP_NIL: case OP_TRUE: case OP_FALSE: case OP_POP:
+            case OP_EQUAL: case OP_GREATER: case OP_LESS:
+            case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY: case OP_DIVIDE:
+            case OP_NOT: case OP_NEGATE: case OP_PRINT: case OP_RETURN:
+            case OP_GREATER_NUM: case OP_LESS_NUM: case OP_ADD_NUM: case OP_SUBTRACT_NUM:
+            case OP_MULTIPLY_NUM: case OP_DIVIDE_NUM: case OP_NEGATE_NUM:
+            case OP_GET_INDEX: case OP_SET_INDEX: case OP_IN: case OP_DELETE:
+                offset += 1;
+                break;
+            default:
+                std::cerr<<"emit-cpp: unsupported opcode "<<(int)chunk.getCode(offset)
+                         <<" at offset "<<offset<<std::endl;
+                return false;
+        }
+    }
+    return true;
+}
+
+bool emitCpp(const Chunk& chunk, const char* name, std::ostream& out){
+    if(!chunk.isVerified()){
+        std::cerr<<"emit-cpp: chunk has not been verified"<<std::endl;
+        return false;
+    }
+    std::set<int> targets;
+    std::set<int> constants;
+    if(!collect(chunk, &targets, &constants)) return false;
+    for(int index : constants){
+        Value value = chunk.getConstant(index);
+        if(IS_OBJ(value) && IS_FUNCTION(value)){
+            //运行时库没有调用帧，只能翻译顶层代码
+            std::cerr<<"emit-cpp: functions are not supported, only scripts without 'fun' can be compiled"<<std::endl;
+            return false;
+        }
+    }
+
+    out<<"// generated by cpplox --emit-cpp from "<<name<<"\n";
+    out<<"#include \"runtime.h\"\n\n";
+    out<<"static InterpretResult lox_script(Runtime& rt){\n";
+    //验证器算出的最大栈深度，和VM给这个chunk留的一样多
+    out<<"    Value* stack = rt.stack("<<chunk.getMaxStack()<<");\n";
+    out<<"    Value* sp = stack;\n";
+    out<<"    (void)stack;\n";
+    for(int index : constants){
+        out<<"    const Value k"<<index<<" = ";
+        emitConstantValue(chunk.getConstant(index), out);
+        out<<";\n";
+    }
+    out<<"\n";
+
+    for(int offset = 0; offset < chunk.getCount();){
+        if(targets.count(offset)) out<<"L"<<offset<<":\n";
+        int line = chunk.getLine(offset);
+        uint8_t instruction = chunk.getCode(offset);
+        int operand = offset + 1 < chunk.getCount() ? chunk.getCode(offset + 1) : 0;
+        //_LONG形式生成的代码和单字节形式一样，只是操作数多两个字节
+        uint8_t shortForm = instruction;
+        switch(instruction){
+            case OP_CONSTANT_LONG:      shortForm = OP_CONSTANT; break;
+            case OP_GET_GLOBAL_LONG:    shortForm = OP_GET_GLOBAL; break;
+            case OP_DEFINE_GLOBAL_LONG: shortForm = OP_DEFINE_GLOBAL; break;
+            case OP_SET_GLOBAL_LONG:    shortForm = OP_SET_GLOBAL; break;
+        }
+        if(shortForm != instruction){
+            instruction = shortForm;
+            operand = chunk.getLong(offset + 1);
+            offset += 2;
+        }
+        out<<"    ";
+        switch(instruction){
+            case OP_CONSTANT:
+                out<<"*sp++ = k"<<operand<<";";
+                offset += 2; break;
+            case OP_NIL:   out<<"*sp++ = NIL_VAL;"; offset += 1; break;
+            case OP_TRUE:  out<<"*sp++ = BOOL_VAL(true);"; offset += 1; break;
+            case OP_FALSE: out<<"*sp++ = BOOL_VAL(false);"; offset += 1; break;
+            case OP_POP:   out<<"sp--;"; offset += 1; break;
+            case OP_GET_LOCAL:
+                out<<"*sp++ = stack["<<(int)operand<<"];";
+                offset += 2; break;
+            case OP_SET_LOCAL:
+                out<<"stack["<<(int)operand<<"] = sp[-1];";
+                offset += 2; break;
+            case OP_GET_GLOBAL:
+                out<<"if(!rt.getGlobal(k"<<(int)operand<<", sp++, "<<line<<")) return INTERPRET_RUNTIME_ERROR;";
+                offset += 2; break;
+            case OP_DEFINE_GLOBAL:
+                out<<"rt.defineGlobal(k"<<(int)operand<<", *--sp);";
+                offset += 2; break;
+            case OP_SET_GLOBAL:
+                out<<"if(!rt.setGlobal(k"<<(int)operand<<", sp[-1], "<<line<<")) return INTERPRET_RUNTIME_ERROR;";
+                offset += 2; break;
+            case OP_EQUAL:
+                out<<"sp[-2] = BOOL_VAL(valuesEqual(sp[-2], sp[-1])); sp--;";
+                offset += 1; break;
+            case OP_GREATER:  out<<"AOT_BINARY(numberGreater, "<<line<<");"; offset += 1; break;
+            case OP_LESS:     out<<"AOT_BINARY(numberLess, "<<line<<");"; offset += 1; break;
+            case OP_ADD:      out<<"AOT_ADD("<<line<<");"; offset += 1; break;
+            case OP_SUBTRACT: out<<"AOT_BINARY(numberSubtract, "<<line<<");"; offset += 1; break;
+            case OP_MULTIPLY: out<<"AOT_BINARY(numberMultiply, "<<line<<");"; offset += 1; break;
+            case OP_DIVIDE:   out<<"AOT_BINARY(numberDivide, "<<line<<");"; offset += 1; break;
+            case OP_NOT:
+                out<<"sp[-1] = BOOL_VAL(aotIsFalsey(sp[-1]));";
+                offset += 1; break;
+            case OP_NEGATE: out<<"AOT_NEGATE("<<line<<");"; offset += 1; break;
+            case OP_GREATER_NUM:  out<<"AOT_NUMBER(numberGreater);"; offset += 1; break;
+            case OP_LESS_NUM:     out<<"AOT_NUMBER(numberLess);"; offset += 1; break;
+            case OP_ADD_NUM:      out<<"AOT_NUMBER(numberAdd);"; offset += 1; break;
+            case OP_SUBTRACT_NUM: out<<"AOT_NUMBER(numberSubtract);"; offset += 1; break;
+            case OP_MULTIPLY_NUM: out<<"AOT_NUMBER(numberMultiply);"; offset += 1; break;
+            case OP_DIVIDE_NUM:   out<<"AOT_NUMBER(numberDivide);"; offset += 1; break;
+            case OP_NEGATE_NUM:   out<<"sp[-1] = numberNegate(sp[-1]);"; offset += 1; break;
+            case OP_PRINT:  out<<"rt.print(*--sp);"; offset += 1; break;
+            case OP_JUMP:
+                out<<"goto L"<<jumpTarget(chunk, offset, 1)<<";";
+                offset += 3; break;
+            case OP_JUMP_IF_FALSE:
+                out<<"if(aotIsFalsey(sp[-1])) goto L"<<jumpTarget(chunk, offset, 1)<<";";
+                offset += 3; break;
+            case OP_LOOP:
+                out<<"goto L"<<jumpTarget(chunk, offset, -1)<<";";
+                offset += 3; break;
+            case OP_CALL:
+                out<<"if(!rt.call(sp, "<<operand<<", "<<line<<")) return INTERPRET_RUNTIME_ERROR; sp -= "<<operand<<";";
+                offset += 2; break;
+            case OP_GET_INDEX:
+                out<<"if(!rt.getIndex(sp[-2], sp[-1], &sp[-2], "<<line<<")) return INTERPRET_RUNTIME_ERROR; sp--;";
+                offset += 1; break;
+            case OP_SET_INDEX:
+                out<<"if(!rt.setIndex(sp[-3], sp[-2], sp[-1], "<<line<<")) return INTERPRET_RUNTIME_ERROR; sp[-3] = sp[-1]; sp -= 2;";
+                offset += 1; break;
+            case OP_MAP: {
+                int popped = 2 * operand - 1;   //键值对换成一个散列表
+                out<<"if(!rt.map(sp, "<<operand<<", "<<line<<")) return INTERPRET_RUNTIME_ERROR; ";
+                out<<(popped < 0 ? "sp++;" : "sp -= " + std::to_string(popped) + ";");
+                offset += 2; break;
+            }
+            case OP_IN:
+                out<<"if(!rt.contains(sp[-2], sp[-1], &sp[-2], "<<line<<")) return INTERPRET_RUNTIME_ERROR; sp--;";
+                offset += 1; break;
+            case OP_DELETE:
+                out<<"if(!rt.remove(sp[-2], sp[-1], "<<line<<")) return INTERPRET_RUNTIME_ERROR; sp -= 2;";
+                offset += 1; break;
+            case OP_FOR_TEST: {
+                static const char* exitTests[] = {
+                    "!AS_BOOL(numberLess(a, b))", "AS_BOOL(numberGreater(a, b))",
+                    "!AS_BOOL(numberGreater(a, b))", "AS_BOOL(numberLess(a, b))",
+                };
+                uint8_t mode = chunk.getCode(offset + 2);
+                int limit = chunk.getCode(offset + 3);
+                out<<"{ Value a = stack["<<(int)operand<<"]; Value b = ";
+                if(mode & FOR_LIMIT_LOCAL) out<<"stack["<<limit<<"];";
+                else out<<"k"<<limit<<";";
+                out<<" if(!IS_NUMBER(a) || !IS_NUMBER(b)){ rt.error("<<line
+                   <<", \"Operands must be numbers.\"); return INTERPRET_RUNTIME_ERROR; }";
+                out<<" if("<<exitTests[mode & FOR_CMP_MASK]<<") goto L"
+                   <<jumpTarget(chunk, offset + 3, 1)<<"; }";
+                offset += 6; break;
+            }
+            case OP_FOR_STEP:
+                out<<"if(!IS_NUMBER(stack["<<(int)operand<<"])){ rt.error("<<line<<", \""
+                   <<((chunk.getCode(offset + 2) & FOR_STEP_SUBTRACT) ? "Operands must be numbers." :
+                                                                       "Operands must be two numbers or two strings.")
+                   <<"\"); return INTERPRET_RUNTIME_ERROR; }";
+                out<<" stack["<<(int)operand<<"] = numberAdd(stack["<<(int)operand<<"], k"
+                   <<(int)chunk.getCode(offset + 3)<<"); goto L"<<jumpTarget(chunk, offset + 3, -1)<<";";
+                offset += 6; break;
+            case OP_JUMP_TABLE:
+            case OP_CASE_TABLE: {
+                //稠密的整数直接生成C++的switch，其余查分支表
+                const uint8_t* code = chunk.getFirstCode();
+                int count = switchCount(code, offset);
+                if(instruction == OP_JUMP_TABLE){
+                    int32_t low = (int32_t)(((uint32_t)code[offset + 3] << 24) | (code[offset + 4] << 16) |
+                                            (code[offset + 5] << 8) | code[offset + 6]);
+                    out<<"{ int32_t v; if(caseInteger(*--sp, &v)) switch(v){";
+                    for(int entry = 0; entry < count; entry++){
+                        out<<" case "<<(int64_t)low + entry<<": goto L"<<switchTarget(code, offset, entry)<<";";
+                    }
+                }else{
+                    out<<"{ Value e; if(AS_MAP(k"<<chunk.getLong(offset + 3)
+                       <<")->get(*--sp, &e) && IS_INT(e)) switch(AS_INT(e)){";
+                    for(int entry = 0; entry < count; entry++){
+                        out<<" case "<<entry<<": goto L"<<switchTarget(code, offset, entry)<<";";
+                    }
+                }
+                out<<" } goto L"<<switchTarget(code, offset, count)<<"; }";
+                offset += switchLength(code, offset);
+                break;
+            }
+            case OP_RETURN:
+                out<<"return INTERPRET_OK;";
+                offset += 1; break;
+        }
+        out<<"\n";
+    }
+    //跳转目标可能正好落在代码末尾
+    if(targets.count(chunk.getCount())) out<<"L"<<chunk.getCount()<<":\n";
+    out<<"    return INTERPRET_OK;\n";
+    out<<"}\n\n";
+    out<<"AOT_MAIN(lox_script)\n";
+    return true;
+}
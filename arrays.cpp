@@ -0,0 +1,141 @@
+#include <algorithm>
+#include "arrays.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+//一块LANES个double。不要求对齐，std::vector里的数据只保证8字节对齐
+#if defined(__AVX2__)
+#define LANES 4
+typedef __m256d Lane;
+static inline Lane load(const double* p){ return _mm256_loadu_pd(p); }
+static inline void store(double* p, Lane v){ _mm256_storeu_pd(p, v); }
+static inline Lane splat(double x){ return _mm256_set1_pd(x); }
+static inline Lane add(Lane a, Lane b){ return _mm256_add_pd(a, b); }
+static inline Lane mul(Lane a, Lane b){ return _mm256_mul_pd(a, b); }
+static inline Lane vmin(Lane a, Lane b){ return _mm256_min_pd(a, b); }
+static inline Lane vmax(Lane a, Lane b){ return _mm256_max_pd(a, b); }
+static inline Lane vor(Lane a, Lane b){ return _mm256_or_pd(a, b); }
+static inline Lane unordered(Lane v){ return _mm256_cmp_pd(v, v, _CMP_UNORD_Q); }
+static inline int anyLane(Lane v){ return _mm256_movemask_pd(v); }
+#elif defined(__SSE2__)
+#define LANES 2
+typedef __m128d Lane;
+static inline Lane load(const double* p){ return _mm_loadu_pd(p); }
+static inline void store(double* p, Lane v){ _mm_storeu_pd(p, v); }
+static inline Lane splat(double x){ return _mm_set1_pd(x); }
+static inline Lane add(Lane a, Lane b){ return _mm_add_pd(a, b); }
+static inline Lane mul(Lane a, Lane b){ return _mm_mul_pd(a, b); }
+static inline Lane vmin(Lane a, Lane b){ return _mm_min_pd(a, b); }
+static inline Lane vmax(Lane a, Lane b){ return _mm_max_pd(a, b); }
+static inline Lane vor(Lane a, Lane b){ return _mm_or_pd(a, b); }
+static inline Lane unordered(Lane v){ return _mm_cmpunord_pd(v, v); }
+static inline int anyLane(Lane v){ return _mm_movemask_pd(v); }
+#endif
+
+#ifdef LANES
+static inline double sumLanes(Lane v){
+    double lanes[LANES];
+    store(lanes, v);
+    double sum = 0;
+    for(int i = 0; i < LANES; i++) sum += lanes[i];
+    return sum;
+}
+#endif
+
+//四个累加器交替使用，加法之间没有依赖，能填满流水线
+double arraySum(const double* a, size_t n){
+    size_t i = 0;
+    double sum = 0;
+#ifdef LANES
+    Lane s0 = splat(0), s1 = splat(0), s2 = splat(0), s3 = splat(0);
+    for(; i + 4 * LANES <= n; i += 4 * LANES){
+        s0 = add(s0, load(a + i));
+        s1 = add(s1, load(a + i + LANES));
+        s2 = add(s2, load(a + i + 2 * LANES));
+        s3 = add(s3, load(a + i + 3 * LANES));
+    }
+    sum = sumLanes(add(add(s0, s1), add(s2, s3)));
+#endif
+    for(; i < n; i++) sum += a[i];
+    return sum;
+}
+
+double arrayDot(const double* a, const double* b, size_t n){
+    size_t i = 0;
+    double sum = 0;
+#ifdef LANES
+    Lane s0 = splat(0), s1 = splat(0), s2 = splat(0), s3 = splat(0);
+    for(; i + 4 * LANES <= n; i += 4 * LANES){
+        s0 = add(s0, mul(load(a + i), load(b + i)));
+        s1 = add(s1, mul(load(a + i + LANES), load(b + i + LANES)));
+        s2 = add(s2, mul(load(a + i + 2 * LANES), load(b + i + 2 * LANES)));
+        s3 = add(s3, mul(load(a + i + 3 * LANES), load(b + i + 3 * LANES)));
+    }
+    sum = sumLanes(add(add(s0, s1), add(s2, s3)));
+#endif
+    for(; i < n; i++) sum += a[i] * b[i];
+    return sum;
+}
+
+//min/max指令遇到NaN时的结果取决于操作数顺序，所以NaN单独用一个掩码记下来
+static double extreme(const double* a, size_t n, bool wantMax){
+    size_t i = 0;
+    double best = a[0];
+    bool nan = false;
+#ifdef LANES
+    if(n >= LANES){
+        Lane b = load(a);
+        Lane seen = unordered(b);
+        for(i = LANES; i + LANES <= n; i += LANES){
+            Lane v = load(a + i);
+            seen = vor(seen, unordered(v));
+            b = wantMax ? vmax(b, v) : vmin(b, v);
+        }
+        nan = anyLane(seen) != 0;
+        double lanes[LANES];
+        store(lanes, b);
+        best = lanes[0];
+        for(int j = 1; j < LANES; j++){
+            if(wantMax ? lanes[j] > best : lanes[j] < best) best = lanes[j];
+        }
+    }
+#endif
+    for(; i < n; i++){
+        if(a[i] != a[i]) nan = true;
+        else if(wantMax ? a[i] > best : a[i] < best) best = a[i];
+    }
+    return nan ? NAN : best;
+}
+
+double arrayMin(const double* a, size_t n){
+    return extreme(a, n, false);
+}
+
+double arrayMax(const double* a, size_t n){
+    return extreme(a, n, true);
+}
+
+void arrayScale(double* a, size_t n, double k){
+    size_t i = 0;
+#ifdef LANES
+    Lane factor = splat(k);
+    for(; i + LANES <= n; i += LANES) store(a + i, mul(load(a + i), factor));
+#endif
+    for(; i < n; i++) a[i] *= k;
+}
+
+void arrayAdd(double* a, const double* b, size_t n){
+    size_t i = 0;
+#ifdef LANES
+    for(; i + LANES <= n; i += LANES) store(a + i, add(load(a + i), load(b + i)));
+#endif
+    for(; i < n; i++) a[i] += b[i];
+}
+
+//NaN和任何数比较都是false，不满足std::sort要求的严格弱序，先挪到末尾
+void arraySort(double* a, size_t n){
+    double* end = std::partition(a, a + n, [](double x){ return x == x; });
+    std::sort(a, end);
+}
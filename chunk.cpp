@@ -1,24 +1,41 @@
 #include <stdlib.h>
 #include "chunk.h"
 #include "value.h"
+#include "object.h"
 
 Chunk::Chunk(){
-    
+    m_frozen = false;
+    m_maxStack = -1;
 }
 
 Chunk::~Chunk(){
+    for(Obj* object : m_owned){
+        delete object;
+    }
+    m_owned.clear();
     m_code.clear();
     m_constants.clear();
     m_lines.clear();
 }
 
 void Chunk::writeChunk(uint8_t byte, int line){
+    assert(!m_frozen);
     m_code.push_back(byte);
     m_lines.push_back(line);
+    m_maxStack = -1;
+}
+
+void Chunk::writeCode(const uint8_t* code, int count, int line){
+    assert(!m_frozen);
+    m_code.insert(m_code.end(), code, code + count);
+    m_lines.insert(m_lines.end(), count, line);
+    m_maxStack = -1;
 }
 
 int Chunk::addConstant(Value value){
+    assert(!m_frozen);
     m_constants.push_back(value);
+    m_maxStack = -1;
     return m_constants.size()-1;
 }
 
@@ -34,6 +51,10 @@ Value Chunk::getConstant(int offset) const{
     return m_constants[offset];
 }
 
+int Chunk::getConstantCount() const{
+    return m_constants.size();
+}
+
 uint8_t* Chunk::getFirstCode() const{
     if (m_code.size() > 0) {
         return const_cast<uint8_t*>(&m_code[0]);
@@ -50,6 +71,75 @@ uint8_t Chunk::getInstruction(int offset) const{
     return m_code[offset];
 }
 
+int Chunk::getLong(int offset) const{
+    return (m_code[offset] << 16) | (m_code[offset + 1] << 8) | m_code[offset + 2];
+}
+
 void Chunk::changeCode(int offset, uint8_t content){
+    assert(!m_frozen);
     m_code[offset] = content;
-}
\ No newline at end of file
+    m_maxStack = -1;
+}
+
+void Chunk::copyFrom(const Chunk& source){
+    assert(!source.m_frozen && source.m_owned.empty());
+    m_code = source.m_code;
+    m_constants = source.m_constants;
+    m_lines = source.m_lines;
+    m_maxStack = source.m_maxStack;
+}
+
+static ObjString* freezeString(ObjString* source, std::vector<Obj*>* owned){
+    ObjString* copy = new ObjString(source->m_chars, source->m_length);
+    owned->push_back(copy);
+    return copy;
+}
+
+void Chunk::freeze(){
+    if(m_frozen) return;
+    for(Value& constant : m_constants){
+        if(IS_OBJ(constant) && IS_STRING(constant)){
+            constant = OBJ_VAL(freezeString(AS_STRING(constant), &m_owned));
+        }else if(IS_OBJ(constant) && IS_FUNCTION(constant)){
+            //函数连同它的chunk一起复制，递归冻结，归外层chunk所有
+            ObjFunction* source = AS_FUNCTION(constant);
+            assert(!source->m_chunk.isFrozen());
+            ObjFunction* copy = new ObjFunction();
+            copy->m_arity = source->m_arity;
+            copy->m_name = freezeString(source->m_name, &m_owned);
+            copy->m_chunk.copyFrom(source->m_chunk);
+            copy->m_chunk.freeze();
+            m_owned.push_back(copy);
+            constant = OBJ_VAL(copy);
+        }else if(IS_OBJ(constant) && IS_MAP(constant)){
+            //switch的分支表，键里的字符串也要复制
+            ObjMap* source = AS_MAP(constant);
+            ObjMap* copy = new ObjMap();
+            for(size_t i = 0; i < source->m_ctrl.size(); i++){
+                if(source->m_ctrl[i] < 0) continue;
+                Value key = source->m_entries[i].key;
+                if(IS_OBJ(key) && IS_STRING(key)) key = OBJ_VAL(freezeString(AS_STRING(key), &m_owned));
+                copy->set(key, source->m_entries[i].value);
+            }
+            m_owned.push_back(copy);
+            constant = OBJ_VAL(copy);
+        }
+    }
+    m_frozen = true;
+}
+
+bool Chunk::isFrozen() const{
+    return m_frozen;
+}
+
+void Chunk::setMaxStack(int depth){
+    m_maxStack = depth;
+}
+
+int Chunk::getMaxStack() const{
+    return m_maxStack;
+}
+
+bool Chunk::isVerified() const{
+    return m_maxStack >= 0;
+}
@@ -1,17 +1,21 @@
 #include <iostream>
+#include <algorithm>
 #include <string.h>
 #include "compiler.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
 #endif
 
 ParseRule Compiler::m_rules[] = {
-        [TOKEN_LEFT_PAREN]    = {(ParseFn)&Compiler::grouping,  NULL,   PREC_NONE},
+        [TOKEN_LEFT_PAREN]    = {(ParseFn)&Compiler::grouping,  (ParseFn)&Compiler::call,   PREC_CALL},
         [TOKEN_RIGHT_PAREN]   = {NULL,                        NULL,   PREC_NONE},
-        [TOKEN_LEFT_BRACE]    = {NULL,                        NULL,   PREC_NONE},
+        [TOKEN_LEFT_BRACE]    = {(ParseFn)&Compiler::mapLiteral, NULL, PREC_NONE},
         [TOKEN_RIGHT_BRACE]   = {NULL,                        NULL,   PREC_NONE},
+        [TOKEN_LEFT_BRACKET]  = {NULL,                        (ParseFn)&Compiler::index,  PREC_CALL},
+        [TOKEN_RIGHT_BRACKET] = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_COMMA]         = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_DOT]           = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_MINUS]         = {(ParseFn)&Compiler::unary,     (ParseFn)&Compiler::binary, PREC_TERM},
@@ -19,6 +23,7 @@ ParseRule Compiler::m_rules[] = {
         [TOKEN_SEMICOLON]     = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_SLASH]         = {NULL,                        (ParseFn)&Compiler::binary, PREC_FACTOR},
         [TOKEN_STAR]          = {NULL,                        (ParseFn)&Compiler::binary, PREC_FACTOR},
+        [TOKEN_COLON]         = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_BANG]          = {(ParseFn)&Compiler::unary,     NULL,   PREC_NONE},
         [TOKEN_BANG_EQUAL]    = {NULL,                        (ParseFn)&Compiler::binary, PREC_EQUALITY},
         [TOKEN_EQUAL]         = {NULL,                        NULL,   PREC_NONE},
@@ -31,17 +36,22 @@ ParseRule Compiler::m_rules[] = {
         [TOKEN_STRING]        = {(ParseFn)&Compiler::string,    NULL,   PREC_NONE},
         [TOKEN_NUMBER]        = {(ParseFn)&Compiler::number,    NULL,   PREC_NONE},
         [TOKEN_AND]           = {NULL,                        (ParseFn)&Compiler::and_,   PREC_AND},
+        [TOKEN_CASE]          = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_CLASS]         = {NULL,                        NULL,   PREC_NONE},
+        [TOKEN_DEFAULT]       = {NULL,                        NULL,   PREC_NONE},
+        [TOKEN_DELETE]        = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_ELSE]          = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_FALSE]         = {(ParseFn)&Compiler::literal,   NULL,   PREC_NONE},
         [TOKEN_FOR]           = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_FUN]           = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_IF]            = {NULL,                        NULL,   PREC_NONE},
+        [TOKEN_IN]            = {NULL,                        (ParseFn)&Compiler::binary, PREC_COMPARISON},
         [TOKEN_NIL]           = {(ParseFn)&Compiler::literal,   NULL,   PREC_NONE},
         [TOKEN_OR]            = {NULL,                        (ParseFn)&Compiler::or_,    PREC_OR},
         [TOKEN_PRINT]         = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_RETURN]        = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_SUPER]         = {NULL,                        NULL,   PREC_NONE},
+        [TOKEN_SWITCH]        = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_THIS]          = {NULL,                        NULL,   PREC_NONE},
         [TOKEN_TRUE]          = {(ParseFn)&Compiler::literal,   NULL,   PREC_NONE},
         [TOKEN_VAR]           = {NULL,                        NULL,   PREC_NONE},
@@ -50,14 +60,22 @@ ParseRule Compiler::m_rules[] = {
         [TOKEN_EOF]           = {NULL,                        NULL,   PREC_NONE},
 };
 
-Compiler::Compiler(const std::string& source, Chunk* chunk){
+Compiler::Compiler(VM* vm, const std::string& source, Chunk* chunk)
+    : Compiler(vm, source.data(), source.size(), chunk){
+}
+
+Compiler::Compiler(VM* vm, const char* source, size_t length, Chunk* chunk){
+    m_vm = vm;
     m_hadError = false;
     m_panicMode = false;
     m_chunk = chunk;
-    m_sc = new Scanner(source);
+    m_sc = new Scanner(source, length);
 
     m_localCount = 0;
     m_scopeDepth = 0;
+    m_function = nullptr;
+    m_type = TYPE_SCRIPT;
+    m_lastGetIndex = -1;
 }
 
 Compiler::~Compiler(){
@@ -68,17 +86,18 @@ void Compiler::errorAt(Token* token, const char* message){
     if(m_panicMode) return;     //出现一个错误后屏蔽后续的一连串错误
     m_panicMode = true; //设置之后字节码不会被执行
 
-    std::cerr<<"[line "<<token->line<<"] error";
+    std::ostream& err = m_vm->err();
+    err<<"[line "<<token->line<<"] error";
 
     if(token->type == TOKEN_EOF){
-        std::cerr<<" at end";
+        err<<" at end";
     }else if(token->type == TOKEN_ERROR){
 
     }else{
-        std::cerr << " at '" << std::string(token->start, token->length) << "'  ";
+        err << " at '" << std::string(token->start, token->length) << "'  ";
     }
 
-    std::cerr<<message<<std::endl;
+    err<<message<<std::endl;
     m_hadError = true;
 }
 
@@ -125,7 +144,9 @@ void Compiler::synchronize() {
             case TOKEN_IF:
             case TOKEN_WHILE:
             case TOKEN_PRINT:
+            case TOKEN_DELETE:
             case TOKEN_RETURN:
+            case TOKEN_SWITCH:
                 return;
 
             default:
@@ -172,10 +193,32 @@ int Compiler::emitJump(uint8_t instruction){
 }
 
 void Compiler::emitConstant(Value value){
-    emitBytes(OP_CONSTANT, m_chunk->addConstant(value));
+    emitConstantOp(OP_CONSTANT, OP_CONSTANT_LONG, makeConstant(value));
 }
 
+void Compiler::emitConstantOp(uint8_t op, uint8_t longOp, int index){
+    if(index <= UINT8_MAX){
+        emitBytes(op, (uint8_t)index);
+        return;
+    }
+    emitByte(longOp);
+    emitByte((index >> 16) & 0xff);
+    emitByte((index >> 8) & 0xff);
+    emitByte(index & 0xff);
+}
+
+int Compiler::makeConstant(Value value){
+    int constant = m_chunk->addConstant(value);
+    if(constant > CONSTANT_LONG_MAX){
+        error("Too many constants in one chunk.");
+        return 0;
+    }
+    return constant;
+}
+
+//顶层代码的OP_RETURN结束整个脚本，栈上没有返回值；函数默认返回nil
 void Compiler::emitReturn(){
+    if(m_type == TYPE_FUNCTION) emitByte(OP_NIL);
     emitByte(OP_RETURN);
 }
 
@@ -194,7 +237,7 @@ void Compiler::endCompiler(){
     emitReturn();
 #ifdef DEBUG_PRINT_CODE
     if (!m_hadError) {
-    disassembleChunk(*m_chunk, "code");
+    disassembleChunk(*m_chunk, m_function != nullptr ? m_function->m_name->m_string.c_str() : "code", m_vm->out());
   }
 #endif
 }
@@ -202,6 +245,7 @@ void Compiler::endCompiler(){
 void Compiler::grouping(bool canAssign){
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression");
+    m_lastGetIndex = -1;    //括号里的下标可能在and/or的分支里，不能改成删除
 }
 
 void Compiler::unary(bool canAssign){
@@ -235,10 +279,63 @@ void Compiler::binary(bool canAssign){
         case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
         case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
         case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
+        case TOKEN_IN:            emitByte(OP_IN); break;
         default: return; // Unreachable.
     }
 }
 
+//调用：被调用者已经在栈上，实参依次入栈
+void Compiler::call(bool canAssign){
+    uint8_t argCount = argumentList();
+    emitBytes(OP_CALL, argCount);
+}
+
+//a[i]和a[i] = value，value留在栈上作为赋值表达式的值
+void Compiler::index(bool canAssign){
+    expression();
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+    if(canAssign && match(TOKEN_EQUAL)){
+        expression();
+        emitByte(OP_SET_INDEX);
+    }else{
+        emitByte(OP_GET_INDEX);
+        m_lastGetIndex = m_chunk->getCount() - 1;
+    }
+}
+
+//{key: value, ...}：键值对依次入栈，OP_MAP一次建好整个散列表
+void Compiler::mapLiteral(bool canAssign){
+    int count = 0;
+    if(!check(TOKEN_RIGHT_BRACE)){
+        do{
+            expression();
+            consume(TOKEN_COLON, "Expect ':' after map key.");
+            expression();
+            if(count == 255){
+                error("Can't have more than 255 entries in a map literal.");
+            }
+            count++;
+        }while(match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    emitBytes(OP_MAP, (uint8_t)count);
+}
+
+uint8_t Compiler::argumentList(){
+    uint8_t argCount = 0;
+    if(!check(TOKEN_RIGHT_PAREN)){
+        do{
+            expression();
+            if(argCount == 255){
+                error("Can't have more than 255 arguments.");
+            }
+            argCount++;
+        }while(match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    return argCount;
+}
+
 void Compiler::literal(bool canAssign){
     switch(m_previous.type){
         case TOKEN_FALSE: emitByte(OP_FALSE); break;
@@ -276,12 +373,25 @@ ParseRule* Compiler::getRule(TokenType type){
 }
 
 void Compiler::number(bool canAssign){
-    double value = strtod(m_previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+    emitConstant(numberValue(m_previous));
+}
+
+//不带小数点且放得下int32的字面量直接按整数解析，不走strtod
+Value Compiler::numberValue(const Token& token){
+    const char* start = token.start;
+    int length = token.length;
+    if(length <= 9 && memchr(start, '.', length) == NULL){
+        int32_t value = 0;
+        for(int i = 0; i < length; i++){
+            value = value * 10 + (start[i] - '0');
+        }
+        return INT_VAL(value);
+    }
+    return NUMBER_VAL(strtod(start, NULL));
 }
 
 void Compiler::string(bool canAssign) {
-    emitConstant(OBJ_VAL(copyString(m_previous.start+1 ,
+    emitConstant(OBJ_VAL(copyString(m_vm, m_previous.start+1 ,
                                     m_previous.length - 2)));
 }
 
@@ -304,9 +414,16 @@ void Compiler::parsePrecedence(Precedence precedence){
     }
 }
 
-uint8_t Compiler::identifierConstant(Token* name) {
-    return m_chunk->addConstant(OBJ_VAL(copyString(name->start,
+//生成的脚本里同一个全局变量会被引用成千上万次，按源码里的名字缓存常量下标，
+//重复引用既不再驻留字符串，也不再往常量表追加
+int Compiler::identifierConstant(Token* name) {
+    std::string_view key(name->start, name->length);
+    auto it = m_identifiers.find(key);
+    if(it != m_identifiers.end()) return it->second;
+    int constant = makeConstant(OBJ_VAL(copyString(m_vm, name->start,
                                                    name->length)));
+    m_identifiers.emplace(key, constant);
+    return constant;
 }
 
 bool Compiler::identifiersEqual(Token* a, Token* b){
@@ -315,16 +432,12 @@ bool Compiler::identifiersEqual(Token* a, Token* b){
 }
 
 int Compiler::resolveLocal(Token* name){
-    for (int i = m_localCount - 1; i >= 0; i--) {
-        Local* local = &m_locals[i];
-        if (identifiersEqual(name, &local->name)) {
-            if (local->depth == -1) {
-                error("Can't read local variable in its own initializer.");
-            }
-            return i;
-        }
+    auto it = m_localIndex.find(std::string_view(name->start, name->length));
+    if (it == m_localIndex.end()) return -1;
+    if (m_locals[it->second].depth == -1) {
+        error("Can't read local variable in its own initializer.");
     }
-    return -1;
+    return it->second;
 }
 
 void Compiler::expression(){
@@ -347,7 +460,10 @@ void Compiler::endScope(){
     m_scopeDepth--;
     while(m_localCount > 0 && m_locals[m_localCount - 1].depth > m_scopeDepth){
         emitByte(OP_POP);
-        m_localCount--;
+        Local* local = &m_locals[--m_localCount];
+        std::string_view key(local->name.start, local->name.length);
+        if(local->shadowed == -1) m_localIndex.erase(key);
+        else m_localIndex[key] = local->shadowed;
     }
 }
 
@@ -356,9 +472,14 @@ void Compiler::addLocal(Token name){
         error("Too many local variables in function.");
         return;
     }
-    Local* local = &m_locals[m_localCount++];
+    Local* local = &m_locals[m_localCount];
     local->name = name;
     local->depth = -1;  //已声明还未初始化
+    //m_localIndex里只留最内层的同名变量，外层的串在shadowed上，离开作用域时恢复
+    auto inserted = m_localIndex.emplace(std::string_view(name.start, name.length), m_localCount);
+    local->shadowed = inserted.second ? -1 : inserted.first->second;
+    inserted.first->second = m_localCount;
+    m_localCount++;
 }
 
 //声明局部变量
@@ -366,20 +487,80 @@ void Compiler::addLocal(Token name){
 void Compiler::declareVariable(){
     if(m_scopeDepth == 0) return;
     Token* name = &m_previous;
-    for(int i = m_localCount-1; i>=0; i--){
-        Local* local = &m_locals[i];
-        if(local->depth != -1 && local->depth < m_scopeDepth){
-            break;
-        }
-        if (identifiersEqual(name, &local->name)) {
+    //只需要看最内层的同名变量：它在外层作用域就不算重复定义
+    auto it = m_localIndex.find(std::string_view(name->start, name->length));
+    if(it != m_localIndex.end()){
+        Local* local = &m_locals[it->second];
+        if(local->depth == -1 || local->depth >= m_scopeDepth){
             error("Already a variable with this name in this scope.");
         }
     }
     addLocal(*name);
 }
 
+void Compiler::swapState(FunctionState* state){
+    std::swap(m_function, state->function);
+    std::swap(m_type, state->type);
+    std::swap(m_chunk, state->chunk);
+    std::swap(m_locals, state->locals);
+    std::swap(m_localCount, state->localCount);
+    std::swap(m_scopeDepth, state->scopeDepth);
+    std::swap(m_localIndex, state->localIndex);
+    std::swap(m_identifiers, state->identifiers);
+}
+
+//编译参数列表和函数体，函数对象作为常量留在外层chunk的栈顶
+void Compiler::function(){
+    ObjFunction* function = (ObjFunction*)allocateObj(m_vm, OBJ_FUNCTION);
+    function->m_name = copyString(m_vm, m_previous.start, m_previous.length);
+
+    FunctionState enclosing;
+    enclosing.function = function;
+    enclosing.type = TYPE_FUNCTION;
+    enclosing.chunk = &function->m_chunk;
+    enclosing.localCount = 0;
+    enclosing.scopeDepth = 0;
+    swapState(&enclosing);      //之后enclosing里是外层函数的状态
+    m_enclosing.push_back(&enclosing);
+
+    //槽位0是被调用的函数本身，名字为空，脚本里访问不到
+    Local* callee = &m_locals[m_localCount++];
+    callee->name.start = "";
+    callee->name.length = 0;
+    callee->depth = 0;
+    callee->shadowed = -1;
+
+    beginScope();
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+    if (!check(TOKEN_RIGHT_PAREN)) {
+        do {
+            function->m_arity++;
+            if (function->m_arity > 255) {
+                errorAtCurrent("Can't have more than 255 parameters.");
+            }
+            int constant = parseVariable("Expect parameter name.");
+            defineVariable(constant);
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block();
+    endCompiler();      //返回时整个栈帧一起丢掉，不需要endScope
+
+    m_enclosing.pop_back();
+    swapState(&enclosing);
+    emitConstant(OBJ_VAL(function));
+}
+
+void Compiler::funDeclaration(){
+    int global = parseVariable("Expect function name.");
+    markInitialized();      //函数体里可以递归引用自己
+    function();
+    defineVariable(global);
+}
+
 void Compiler::varDeclaration() {
-    uint8_t global = parseVariable("Expect variable name.");
+    int global = parseVariable("Expect variable name.");
 
     if (match(TOKEN_EQUAL)) {
         expression();
@@ -393,23 +574,33 @@ void Compiler::varDeclaration() {
 }
 
 void Compiler::namedVariable(Token name, bool canAssign) {
-    uint8_t getOp, setOp;
+    uint8_t getOp, setOp, getLongOp, setLongOp;
     int arg = resolveLocal(&name);  //返回-1表明是全局变量，否则返回在m_Locals数组中的位置
     if (arg != -1) {
-        getOp = OP_GET_LOCAL;
-        setOp = OP_SET_LOCAL;
+        getOp = getLongOp = OP_GET_LOCAL;   //局部变量最多256个，不会用到_LONG形式
+        setOp = setLongOp = OP_SET_LOCAL;
     } else {
         arg = identifierConstant(&name);
+        //没有闭包：外层函数的局部变量在这里不可见，与其在运行时报未定义的全局变量，不如编译时就报错
+        std::string_view key(name.start, name.length);
+        for (FunctionState* state : m_enclosing) {
+            if (state->localIndex.count(key)) {
+                error("Can't use a local variable of an enclosing function; closures are not supported.");
+                break;
+            }
+        }
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
+        getLongOp = OP_GET_GLOBAL_LONG;
+        setLongOp = OP_SET_GLOBAL_LONG;
     }
     //查找标识符后面的等号。如果找到了，我们就不会生成变量访问的代码，
     //我们会编译所赋的值，然后生成一个赋值指令。
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(setOp, (uint8_t)arg);
+        emitConstantOp(setOp, setLongOp, arg);
     } else {
-        emitBytes(getOp, (uint8_t)arg);
+        emitConstantOp(getOp, getLongOp, arg);
     }
 }
 
@@ -417,7 +608,7 @@ void Compiler::variable(bool canAssign){
     namedVariable(m_previous, canAssign);
 }
 
-uint8_t Compiler::parseVariable(const char* errorMessage) {
+int Compiler::parseVariable(const char* errorMessage) {
     consume(TOKEN_IDENTIFIER, errorMessage);
     declareVariable();
     if (m_scopeDepth > 0) return 0;
@@ -425,15 +616,16 @@ uint8_t Compiler::parseVariable(const char* errorMessage) {
 }
 
 void Compiler::markInitialized(){
+    if (m_scopeDepth == 0) return;  //全局函数声明也会走到这里
     m_locals[m_localCount - 1].depth = m_scopeDepth;
 }
 
-void Compiler::defineVariable(uint8_t global) {
+void Compiler::defineVariable(int global) {
     if (m_scopeDepth > 0) { //局部变量不需要写入chunk，它的值就在栈顶
         markInitialized();  //例如var a = 1+2; 执行完之后栈顶就是3;
         return;                 
     }
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitConstantOp(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
 }
 
 void Compiler::expressionStatement() {
@@ -445,14 +637,21 @@ void Compiler::expressionStatement() {
 void Compiler::forStatement() {
     beginScope();   //for应该在一个作用域内
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    bool declared = false;
     if (match(TOKEN_SEMICOLON)) {
         // 无初始化语句
     } else if (match(TOKEN_VAR)) {
         varDeclaration();
+        declared = true;
     } else {
         expressionStatement();
     }
 
+    if (declared && countedFor()) {
+        endScope();
+        return;
+    }
+
     int loopStart = m_chunk->getCount();
     int exitJump = -1;
     if (!match(TOKEN_SEMICOLON)) {
@@ -486,6 +685,80 @@ void Compiler::forStatement() {
     endScope();
 }
 
+//识别 for (var i = a; i < n; i = i + k) 形式的计数循环，n是数字字面量或局部变量，
+//比较可以是< <= > >=，自增可以是+或-。条件融合成OP_FOR_TEST，自增和回跳融合成OP_FOR_STEP，
+//每轮循环只多两次分派。先在扫描器的副本上向前看，不符合模式时什么都不消费，返回false
+bool Compiler::countedFor(){
+    enum { LOOKAHEAD = 10 };
+    Token tokens[LOOKAHEAD];
+    Scanner saved = *m_sc;
+    tokens[0] = m_current;
+    for (int i = 1; i < LOOKAHEAD; i++) tokens[i] = m_sc->scanToken();
+    *m_sc = saved;
+
+    Local* loopVar = &m_locals[m_localCount - 1];
+    uint8_t slot = (uint8_t)(m_localCount - 1);
+    for (int i : {0, 4, 6}) {
+        if (tokens[i].type != TOKEN_IDENTIFIER || !identifiersEqual(&tokens[i], &loopVar->name)) return false;
+    }
+    if (tokens[3].type != TOKEN_SEMICOLON || tokens[5].type != TOKEN_EQUAL ||
+        tokens[8].type != TOKEN_NUMBER || tokens[9].type != TOKEN_RIGHT_PAREN) return false;
+
+    uint8_t mode;
+    switch (tokens[1].type) {
+        case TOKEN_LESS:          mode = FOR_CMP_LESS; break;
+        case TOKEN_LESS_EQUAL:    mode = FOR_CMP_LESS_EQUAL; break;
+        case TOKEN_GREATER:       mode = FOR_CMP_GREATER; break;
+        case TOKEN_GREATER_EQUAL: mode = FOR_CMP_GREATER_EQUAL; break;
+        default: return false;
+    }
+    if (tokens[7].type != TOKEN_PLUS && tokens[7].type != TOKEN_MINUS) return false;
+
+    int limit = -1;
+    if (tokens[2].type == TOKEN_IDENTIFIER) {
+        limit = resolveLocal(&tokens[2]);
+        if (limit == -1) return false;      //全局变量走普通形式
+        mode |= FOR_LIMIT_LOCAL;
+    } else if (tokens[2].type != TOKEN_NUMBER) {
+        return false;
+    }
+    //常量下标只有一个字节：放不下时在添加常量之前就退回普通形式，不留下用不到的常量
+    int constants = m_chunk->getConstantCount() + (limit == -1 ? 2 : 1);
+    if (constants - 1 > UINT8_MAX) return false;
+    if (limit == -1) limit = m_chunk->addConstant(numberValue(tokens[2]));
+    //i - k 等价于 i + (-k)，IEEE的减法就是这样定义的
+    Value step = numberValue(tokens[8]);
+    if (tokens[7].type == TOKEN_MINUS) step = numberNegate(step);
+    int stepConstant = m_chunk->addConstant(step);
+
+    for (int i = 0; i < LOOKAHEAD; i++) advance();
+
+    int loopStart = m_chunk->getCount();
+    int testLine = tokens[1].line;
+    m_chunk->writeChunk(OP_FOR_TEST, testLine);
+    m_chunk->writeChunk(slot, testLine);
+    m_chunk->writeChunk(mode, testLine);
+    m_chunk->writeChunk((uint8_t)limit, testLine);
+    m_chunk->writeChunk(0xff, testLine);
+    m_chunk->writeChunk(0xff, testLine);
+    int exitJump = m_chunk->getCount() - 2;
+
+    statement();
+
+    int stepLine = tokens[7].line;
+    m_chunk->writeChunk(OP_FOR_STEP, stepLine);
+    m_chunk->writeChunk(slot, stepLine);
+    m_chunk->writeChunk(tokens[7].type == TOKEN_MINUS ? FOR_STEP_SUBTRACT : 0, stepLine);
+    m_chunk->writeChunk((uint8_t)stepConstant, stepLine);
+    int offset = m_chunk->getCount() - loopStart + 2;
+    if (offset > UINT16_MAX) error("Loop body too large.");
+    m_chunk->writeChunk((offset >> 8) & 0xff, stepLine);
+    m_chunk->writeChunk(offset & 0xff, stepLine);
+
+    patchJump(exitJump);
+    return true;
+}
+
 void Compiler::ifStatement(){
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
     expression();
@@ -504,6 +777,32 @@ void Compiler::ifStatement(){
     patchJump(elseJump);
 }
 
+void Compiler::returnStatement(){
+    if (m_type == TYPE_SCRIPT) {
+        error("Can't return from top-level code.");
+    }
+    if (match(TOKEN_SEMICOLON)) {
+        emitReturn();
+    } else {
+        expression();
+        consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+        emitByte(OP_RETURN);
+    }
+}
+
+//delete map[key];  先按普通的下标表达式编译，再把最后的OP_GET_INDEX改成OP_DELETE。
+//只解析到调用/下标这一级，map[key]之后不能再跟运算符
+void Compiler::deleteStatement() {
+    m_lastGetIndex = -1;
+    parsePrecedence(PREC_CALL);
+    if (m_lastGetIndex != m_chunk->getCount() - 1) {
+        error("Can only delete a map entry.");
+    } else {
+        m_chunk->changeCode(m_lastGetIndex, OP_DELETE);
+    }
+    consume(TOKEN_SEMICOLON, "Expect ';' after delete.");
+}
+
 void Compiler::printStatement() {
     expression();
     consume(TOKEN_SEMICOLON, "Expect ';' after value.");
@@ -527,8 +826,134 @@ void Compiler::whileStatement(){
     emitByte(OP_POP);
 }
 
+//switch (value) { case 1, 2: ... case "a": ... default: ... }
+//分支执行完直接跳到switch之后，不会贯穿到下一个分支；每个分支体是一个作用域。
+//编译到分支体时case值还没有读全，所以先跳过所有分支体，在末尾生成分派指令再跳回选中的分支
+void Compiler::switchStatement(){
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after value.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before switch cases.");
+    int dispatchJump = emitJump(OP_JUMP);
+
+    std::vector<CaseLabel> labels;
+    std::vector<int> bodies;        //每个case分支体的起点
+    std::vector<int> endJumps;
+    int defaultStart = -1;
+    while(!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)){
+        if(match(TOKEN_CASE)){
+            if(bodies.size() == UINT16_MAX) error("Too many cases in switch.");
+            do{
+                Value value = caseLabel();
+                labels.push_back(CaseLabel{value, (int)bodies.size(), m_previous});
+            }while(match(TOKEN_COMMA));
+            consume(TOKEN_COLON, "Expect ':' after case value.");
+            bodies.push_back(m_chunk->getCount());
+        }else if(match(TOKEN_DEFAULT)){
+            if(defaultStart != -1) error("Switch can only have one default.");
+            consume(TOKEN_COLON, "Expect ':' after 'default'.");
+            defaultStart = m_chunk->getCount();
+        }else{
+            errorAtCurrent("Expect 'case' or 'default'.");
+            return;
+        }
+        beginScope();
+        while(!check(TOKEN_CASE) && !check(TOKEN_DEFAULT) && !check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)){
+            declaration();
+        }
+        endScope();
+        endJumps.push_back(emitJump(OP_JUMP));
+    }
+    consume(TOKEN_RIGHT_BRACE, "Expect '}' after switch cases.");
+
+    patchJump(dispatchJump);
+    emitSwitch(labels, bodies, defaultStart);
+    for(int jump : endJumps) patchJump(jump);
+}
+
+//case值只能是数字(可以带负号)或字符串字面量
+Value Compiler::caseLabel(){
+    bool negative = match(TOKEN_MINUS);
+    if(match(TOKEN_NUMBER)){
+        Value value = numberValue(m_previous);
+        return negative ? numberNegate(value) : value;
+    }
+    if(!negative && match(TOKEN_STRING)){
+        return OBJ_VAL(copyString(m_vm, m_previous.start + 1, m_previous.length - 2));
+    }
+    errorAtCurrent("Expect a number or string after 'case'.");
+    return NIL_VAL;
+}
+
+//分派指令：值都是整数且范围不超过个数的SWITCH_MIN_DENSITY倍时按值直接索引，
+//否则把值放进常量散列表。两种都只做一次查找，和case的个数无关
+void Compiler::emitSwitch(std::vector<CaseLabel>& labels, const std::vector<int>& bodies, int defaultStart){
+    bool integers = !labels.empty();
+    for(CaseLabel& label : labels){
+        int32_t value;
+        if(!caseInteger(label.value, &value)){
+            integers = false;
+            break;
+        }
+        label.value = INT_VAL(value);
+    }
+
+    std::vector<int> targets;       //每一项跳到的分支体，-1表示default
+    int64_t low = 0;
+    if(integers){
+        //相等的值保持源码顺序，重复时报在后出现的那个上
+        std::stable_sort(labels.begin(), labels.end(), [](const CaseLabel& a, const CaseLabel& b){
+            return AS_INT(a.value) < AS_INT(b.value);
+        });
+        low = AS_INT(labels.front().value);
+        int64_t range = (int64_t)AS_INT(labels.back().value) - low + 1;
+        if(range > (int64_t)labels.size() * SWITCH_MIN_DENSITY || range > UINT16_MAX){
+            integers = false;
+        }else{
+            targets.assign(range, -1);
+            for(CaseLabel& label : labels){
+                int& target = targets[AS_INT(label.value) - low];
+                if(target != -1) errorAt(&label.token, "Duplicate case value.");
+                target = bodies[label.body];
+            }
+        }
+    }
+
+    int header = 7;
+    int constant = 0;
+    if(!integers){
+        ObjMap* cases = (ObjMap*)allocateObj(m_vm, OBJ_MAP);
+        for(CaseLabel& label : labels){
+            if(!cases->set(label.value, INT_VAL(label.body))) errorAt(&label.token, "Duplicate case value.");
+        }
+        targets = bodies;
+        header = 6;
+        constant = makeConstant(OBJ_VAL(cases));
+    }
+
+    //表项是从指令末尾往回的距离，最后一项是default，没有default时落到指令之后
+    int count = (int)targets.size();
+    int end = m_chunk->getCount() + header + 2 * (count + 1);
+    targets.push_back(defaultStart);
+    emitByte(integers ? OP_JUMP_TABLE : OP_CASE_TABLE);
+    emitBytes((count >> 8) & 0xff, count & 0xff);
+    if(integers){
+        uint32_t bits = (uint32_t)(int32_t)low;
+        for(int shift = 24; shift >= 0; shift -= 8) emitByte((bits >> shift) & 0xff);
+    }else{
+        for(int shift = 16; shift >= 0; shift -= 8) emitByte((constant >> shift) & 0xff);
+    }
+    for(int target : targets){
+        int distance = end - (target == -1 ? (defaultStart == -1 ? end : defaultStart) : target);
+        if(distance > UINT16_MAX) error("Too much code to jump over.");
+        emitBytes((distance >> 8) & 0xff, distance & 0xff);
+    }
+}
+
 void Compiler::declaration(){
-    if (match(TOKEN_VAR)) {
+    if (match(TOKEN_FUN)) {
+        funDeclaration();
+    } else if (match(TOKEN_VAR)) {
         varDeclaration();
     } else {
         statement();
@@ -543,19 +968,27 @@ statement      → exprStmt
                | forStmt
                | ifStmt
                | printStmt
+               | deleteStmt
                | returnStmt
+               | switchStmt
                | whileStmt
                | block ;
 */
 void Compiler::statement(){
     if (match(TOKEN_PRINT)) {
         printStatement();
+    } else if (match(TOKEN_DELETE)) {
+        deleteStatement();
     } else if (match(TOKEN_FOR)) {
         forStatement();
     } else if (match(TOKEN_IF)) {
         ifStatement();
+    } else if (match(TOKEN_RETURN)) {
+        returnStatement();
     } else if (match(TOKEN_WHILE)) {
         whileStatement();    
+    } else if (match(TOKEN_SWITCH)) {
+        switchStatement();
     } else if (match(TOKEN_LEFT_BRACE)) {   // { block
         beginScope();
         block();
@@ -1,104 +1,219 @@
 #include "debug.h"
 
-void disassembleChunk(const Chunk &chunk, const char* name){
-    std::cout << "== " << name << " ==" << std::endl;
+void disassembleChunk(const Chunk &chunk, const char* name, std::ostream& out){
+    out << "== " << name << " ==" << std::endl;
     for(int offset=0; offset<chunk.getCount();)
-        offset = disassembleInstruction(chunk, offset);
+        offset = disassembleInstruction(chunk, offset, out);
 }
 
-static int constantInstruction(const char *name, const Chunk &chunk, int offset){
+//按"%-16s %4d"对齐指令名和第一个操作数
+static void printOperand(std::ostream& out, const char* name, int operand){
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%-16s %4d", name, operand);
+    out<<buffer;
+}
+
+static int constantInstruction(const char *name, const Chunk &chunk, int offset, std::ostream& out){
     //constant 常数下标
     uint8_t constantIndex = chunk.getInstruction(offset + 1);
-    printf("%-16s %4d ",name, constantIndex);
-    printValue(chunk.getConstant(constantIndex));
-    std::cout<<std::endl;
+    printOperand(out, name, constantIndex);
+    out<<" ";
+    printValue(chunk.getConstant(constantIndex), out);
+    out<<std::endl;
     return offset + 2;
 }
 
-static int simpleInstruction(const char* name, int offset) {
-  std::cout<<name<<std::endl;
+static int longConstantInstruction(const char *name, const Chunk &chunk, int offset, std::ostream& out){
+    int constantIndex = chunk.getLong(offset + 1);
+    printOperand(out, name, constantIndex);
+    out<<" ";
+    printValue(chunk.getConstant(constantIndex), out);
+    out<<std::endl;
+    return offset + 4;
+}
+
+static int simpleInstruction(const char* name, int offset, std::ostream& out) {
+  out<<name<<std::endl;
   return offset + 1;
 }
 
 static int byteInstruction(const char* name, const Chunk& chunk,
-                           int offset) {
+                           int offset, std::ostream& out) {
   uint8_t slot = chunk.getCode(offset + 1);
-  printf("%-16s %4d\n", name, slot);
+  printOperand(out, name, slot);
+  out<<std::endl;
   return offset + 2; 
 }
 
 static int jumpInstruction(const char* name, int sign,
-                           const Chunk& chunk, int offset) {
+                           const Chunk& chunk, int offset, std::ostream& out) {
   uint16_t jump = (uint16_t)(chunk.getCode(offset + 1) << 8);
   jump |= chunk.getCode(offset + 2);
-  printf("%-16s %4d -> %d\n", name, offset,
-         offset + 3 + sign * jump);
+  printOperand(out, name, offset);
+  out<<" -> "<<offset + 3 + sign * jump<<std::endl;
   return offset + 3;
 }
 
-int disassembleInstruction(const Chunk &chunk, int offset){
-    std::cout << std::setw(4) << std::setfill('0') << offset<<" ";
+static int forTestInstruction(const Chunk& chunk, int offset, std::ostream& out){
+    static const char* comparisons[] = {"<", "<=", ">", ">="};
+    uint8_t slot = chunk.getCode(offset + 1);
+    uint8_t mode = chunk.getCode(offset + 2);
+    uint8_t limit = chunk.getCode(offset + 3);
+    uint16_t jump = (uint16_t)(chunk.getCode(offset + 4) << 8);
+    jump |= chunk.getCode(offset + 5);
+    printOperand(out, "OP_FOR_TEST", slot);
+    out<<" "<<comparisons[mode & FOR_CMP_MASK]<<" ";
+    if(mode & FOR_LIMIT_LOCAL){
+        out<<"local "<<(int)limit;
+    }else{
+        printValue(chunk.getConstant(limit), out);
+    }
+    out<<" -> "<<offset + 6 + jump<<std::endl;
+    return offset + 6;
+}
+
+static int forStepInstruction(const Chunk& chunk, int offset, std::ostream& out){
+    uint8_t slot = chunk.getCode(offset + 1);
+    uint8_t step = chunk.getCode(offset + 3);
+    uint16_t jump = (uint16_t)(chunk.getCode(offset + 4) << 8);
+    jump |= chunk.getCode(offset + 5);
+    printOperand(out, "OP_FOR_STEP", slot);
+    out<<" += ";
+    printValue(chunk.getConstant(step), out);
+    out<<" -> "<<offset + 6 - jump<<std::endl;
+    return offset + 6;
+}
+
+//switch的分派指令：第一行是下界或分支表常量，之后每个表项一行
+static int switchInstruction(const char* name, const Chunk& chunk, int offset, std::ostream& out){
+    const uint8_t* code = chunk.getFirstCode();
+    int count = switchCount(code, offset);
+    printOperand(out, name, count);
+    if(code[offset] == OP_JUMP_TABLE){
+        int32_t low = (int32_t)(((uint32_t)code[offset + 3] << 24) | (code[offset + 4] << 16) |
+                                (code[offset + 5] << 8) | code[offset + 6]);
+        out<<" from "<<low<<std::endl;
+        for(int entry = 0; entry < count; entry++){
+            out<<"                 "<<low + entry<<" -> "<<switchTarget(code, offset, entry)<<std::endl;
+        }
+    }else{
+        out<<" ";
+        printValue(chunk.getConstant(chunk.getLong(offset + 3)), out);
+        out<<std::endl;
+        for(int entry = 0; entry < count; entry++){
+            out<<"                 #"<<entry<<" -> "<<switchTarget(code, offset, entry)<<std::endl;
+        }
+    }
+    out<<"                 default -> "<<switchTarget(code, offset, count)<<std::endl;
+    return offset + switchLength(code, offset);
+}
+
+int disassembleInstruction(const Chunk &chunk, int offset, std::ostream& out){
+    char prefix[32];
     //与上一条代码同一行，打印 |
     if(offset > 0 && chunk.getLine(offset) == chunk.getLine(offset-1)){
-        std::cout<<"   | ";
+        snprintf(prefix, sizeof(prefix), "%04d    | ", offset);
     }else{
-        std::cout<<std::setw(4)<<std::setfill('0')<<chunk.getLine(offset)<<" ";
+        snprintf(prefix, sizeof(prefix), "%04d %04d ", offset, chunk.getLine(offset));
     }
+    out<<prefix;
     uint8_t instruction = chunk.getInstruction(offset);
     switch (instruction)
     {
         case OP_CONSTANT:
-            return constantInstruction("OP_CONSTANT", chunk, offset);
+            return constantInstruction("OP_CONSTANT", chunk, offset, out);
+        case OP_CONSTANT_LONG:
+            return longConstantInstruction("OP_CONSTANT_LONG", chunk, offset, out);
         case OP_NIL:
-            return simpleInstruction("OP_NIL", offset);
+            return simpleInstruction("OP_NIL", offset, out);
         case OP_TRUE:
-            return simpleInstruction("OP_TRUE", offset);
+            return simpleInstruction("OP_TRUE", offset, out);
         case OP_FALSE:
-            return simpleInstruction("OP_FALSE", offset);
+            return simpleInstruction("OP_FALSE", offset, out);
         case OP_POP:
-            return simpleInstruction("OP_POP", offset);
+            return simpleInstruction("OP_POP", offset, out);
         case OP_GET_LOCAL:
-            return byteInstruction("OP_GET_LOCAL", chunk, offset);
+            return byteInstruction("OP_GET_LOCAL", chunk, offset, out);
         case OP_SET_LOCAL:
-            return byteInstruction("OP_SET_LOCAL", chunk, offset);
+            return byteInstruction("OP_SET_LOCAL", chunk, offset, out);
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return constantInstruction("OP_GET_GLOBAL", chunk, offset, out);
+        case OP_GET_GLOBAL_LONG:
+            return longConstantInstruction("OP_GET_GLOBAL_LONG", chunk, offset, out);
         case OP_DEFINE_GLOBAL:
-            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset, out);
+        case OP_DEFINE_GLOBAL_LONG:
+            return longConstantInstruction("OP_DEFINE_GLOBAL_LONG", chunk, offset, out);
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return constantInstruction("OP_SET_GLOBAL", chunk, offset, out);
+        case OP_SET_GLOBAL_LONG:
+            return longConstantInstruction("OP_SET_GLOBAL_LONG", chunk, offset, out);
         case OP_EQUAL:
-            return simpleInstruction("OP_EQUAL", offset);
+            return simpleInstruction("OP_EQUAL", offset, out);
         case OP_GREATER:
-            return simpleInstruction("OP_GREATER", offset);
+            return simpleInstruction("OP_GREATER", offset, out);
         case OP_LESS:
-            return simpleInstruction("OP_LESS", offset);
+            return simpleInstruction("OP_LESS", offset, out);
         case OP_ADD:
-            return simpleInstruction("OP_ADD", offset);break;
+            return simpleInstruction("OP_ADD", offset, out);break;
         case OP_SUBTRACT:
-            return simpleInstruction("OP_SUBTRACT", offset);
+            return simpleInstruction("OP_SUBTRACT", offset, out);
         case OP_MULTIPLY:
-            return simpleInstruction("OP_MULTIPLY", offset);
+            return simpleInstruction("OP_MULTIPLY", offset, out);
         case OP_DIVIDE:
-            return simpleInstruction("OP_DIVIDE", offset);
+            return simpleInstruction("OP_DIVIDE", offset, out);
         case OP_NOT:
-            return simpleInstruction("OP_NOT", offset);
+            return simpleInstruction("OP_NOT", offset, out);
         case OP_NEGATE:
-            return simpleInstruction("OP_NEGATE", offset);
+            return simpleInstruction("OP_NEGATE", offset, out);
+        case OP_GREATER_NUM:
+            return simpleInstruction("OP_GREATER_NUM", offset, out);
+        case OP_LESS_NUM:
+            return simpleInstruction("OP_LESS_NUM", offset, out);
+        case OP_ADD_NUM:
+            return simpleInstruction("OP_ADD_NUM", offset, out);
+        case OP_SUBTRACT_NUM:
+            return simpleInstruction("OP_SUBTRACT_NUM", offset, out);
+        case OP_MULTIPLY_NUM:
+            return simpleInstruction("OP_MULTIPLY_NUM", offset, out);
+        case OP_DIVIDE_NUM:
+            return simpleInstruction("OP_DIVIDE_NUM", offset, out);
+        case OP_NEGATE_NUM:
+            return simpleInstruction("OP_NEGATE_NUM", offset, out);
         case OP_PRINT:
-            return simpleInstruction("OP_PRINT", offset);
+            return simpleInstruction("OP_PRINT", offset, out);
         case OP_JUMP:
-            return jumpInstruction("OP_JUMP", 1, chunk, offset);
+            return jumpInstruction("OP_JUMP", 1, chunk, offset, out);
         case OP_JUMP_IF_FALSE:
-            return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+            return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset, out);
         case OP_LOOP:
-            return jumpInstruction("OP_LOOP", -1, chunk, offset);
+            return jumpInstruction("OP_LOOP", -1, chunk, offset, out);
+        case OP_CALL:
+            return byteInstruction("OP_CALL", chunk, offset, out);
+        case OP_GET_INDEX:
+            return simpleInstruction("OP_GET_INDEX", offset, out);
+        case OP_SET_INDEX:
+            return simpleInstruction("OP_SET_INDEX", offset, out);
+        case OP_MAP:
+            return byteInstruction("OP_MAP", chunk, offset, out);
+        case OP_IN:
+            return simpleInstruction("OP_IN", offset, out);
+        case OP_DELETE:
+            return simpleInstruction("OP_DELETE", offset, out);
+        case OP_FOR_TEST:
+            return forTestInstruction(chunk, offset, out);
+        case OP_FOR_STEP:
+            return forStepInstruction(chunk, offset, out);
+        case OP_JUMP_TABLE:
+            return switchInstruction("OP_JUMP_TABLE", chunk, offset, out);
+        case OP_CASE_TABLE:
+            return switchInstruction("OP_CASE_TABLE", chunk, offset, out);
         case OP_RETURN:
-            return simpleInstruction("OP_RETURN", offset);
+            return simpleInstruction("OP_RETURN", offset, out);
         break;    
         default:
-            std::cout<<"unknown opcode: "<< instruction;
+            out<<"unknown opcode: "<< (int)instruction<<std::endl;
         break;
     }
-    return 1;
+    return offset + 1;
 }
@@ -0,0 +1,181 @@
+#include <string.h>
+#include "hashmap.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#define GROUP_SIZE 16
+#define CTRL_EMPTY   ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+#define MIN_CAPACITY GROUP_SIZE
+
+//一组控制字节中满足条件的槽的位掩码，第i位对应组内第i个槽
+typedef uint32_t GroupMask;
+
+#if defined(__SSE2__)
+static inline __m128i loadGroup(const int8_t* ctrl){ return _mm_loadu_si128((const __m128i*)ctrl); }
+
+static inline GroupMask matchByte(const int8_t* ctrl, int8_t b){
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(loadGroup(ctrl), _mm_set1_epi8(b)));
+}
+
+//空槽和已删除的槽都是小于-1的负数
+static inline GroupMask matchFree(const int8_t* ctrl){
+    return (GroupMask)_mm_movemask_epi8(_mm_cmplt_epi8(loadGroup(ctrl), _mm_set1_epi8(-1)));
+}
+#else
+static inline GroupMask matchByte(const int8_t* ctrl, int8_t b){
+    GroupMask mask = 0;
+    for(int i = 0; i < GROUP_SIZE; i++) if(ctrl[i] == b) mask |= 1u << i;
+    return mask;
+}
+
+static inline GroupMask matchFree(const int8_t* ctrl){
+    GroupMask mask = 0;
+    for(int i = 0; i < GROUP_SIZE; i++) if(ctrl[i] < -1) mask |= 1u << i;
+    return mask;
+}
+#endif
+
+static inline GroupMask matchEmpty(const int8_t* ctrl){
+    return matchByte(ctrl, CTRL_EMPTY);
+}
+
+//murmur3的最后一步，把输入的每一位扩散到所有位上
+static inline uint64_t mix(uint64_t h){
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hashValue(Value key){
+    switch(key.type){
+        case VAL_NIL: return mix(1);
+        case VAL_BOOL: return mix(AS_BOOL(key) ? 3 : 2);
+        case VAL_INT:
+        case VAL_NUMBER: {
+            double number = AS_NUMBER(key);
+            if(number == 0) number = 0;
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            return mix(bits);
+        }
+        case VAL_OBJ:
+            if(IS_STRING(key)) return mix(AS_STRING(key)->hash());
+            return mix((uintptr_t)AS_OBJ(key));
+    }
+    return 0;
+}
+
+static inline bool keysEqual(Value a, Value b){
+    if(IS_OBJ(a) && IS_OBJ(b) && AS_OBJ(a) == AS_OBJ(b)) return true;
+    return valuesEqual(a, b);
+}
+
+//高位选组，低7位存进控制字节
+static inline size_t firstGroup(uint64_t hash, size_t groups){ return (hash >> 7) & (groups - 1); }
+static inline int8_t tag(uint64_t hash){ return (int8_t)(hash & 0x7f); }
+
+ObjMap::ObjMap(){
+    m_type = OBJ_MAP;
+    m_count = 0;
+    m_growthLeft = 0;
+}
+
+ObjMap::~ObjMap(){
+}
+
+//按组做三角数探测(步长1,2,3...)，组数是2的幂时能走遍所有组。
+//一组里有空槽就说明键从来没有被挤到后面的组，查找到此为止
+long ObjMap::find(Value key, uint64_t hash) const{
+    if(m_ctrl.empty()) return -1;
+    size_t groups = m_ctrl.size() / GROUP_SIZE;
+    size_t group = firstGroup(hash, groups);
+    for(size_t step = 1;; step++){
+        const int8_t* ctrl = &m_ctrl[group * GROUP_SIZE];
+        for(GroupMask mask = matchByte(ctrl, tag(hash)); mask != 0; mask &= mask - 1){
+            size_t slot = group * GROUP_SIZE + __builtin_ctz(mask);
+            if(keysEqual(m_entries[slot].key, key)) return (long)slot;
+        }
+        if(matchEmpty(ctrl) != 0) return -1;
+        group = (group + step) & (groups - 1);
+    }
+}
+
+//沿同样的探测序列找第一个空槽或已删除的槽
+size_t ObjMap::findFree(uint64_t hash) const{
+    size_t groups = m_ctrl.size() / GROUP_SIZE;
+    size_t group = firstGroup(hash, groups);
+    for(size_t step = 1;; step++){
+        GroupMask mask = matchFree(&m_ctrl[group * GROUP_SIZE]);
+        if(mask != 0) return group * GROUP_SIZE + __builtin_ctz(mask);
+        group = (group + step) & (groups - 1);
+    }
+}
+
+//装载因子最多7/8。重建时顺带清掉已删除的槽
+void ObjMap::rehash(size_t capacity){
+    std::vector<int8_t> ctrl(capacity, CTRL_EMPTY);
+    std::vector<MapEntry> entries(capacity, MapEntry{NIL_VAL, NIL_VAL});
+    ctrl.swap(m_ctrl);
+    entries.swap(m_entries);
+    m_growthLeft = capacity - capacity / 8 - m_count;
+    for(size_t i = 0; i < ctrl.size(); i++){
+        if(ctrl[i] < 0) continue;
+        uint64_t hash = hashValue(entries[i].key);
+        size_t slot = findFree(hash);
+        m_ctrl[slot] = tag(hash);
+        m_entries[slot] = entries[i];
+    }
+}
+
+bool ObjMap::get(Value key, Value* value) const{
+    long slot = find(key, hashValue(key));
+    if(slot < 0) return false;
+    *value = m_entries[slot].value;
+    return true;
+}
+
+bool ObjMap::set(Value key, Value value){
+    uint64_t hash = hashValue(key);
+    long found = find(key, hash);
+    if(found >= 0){
+        m_entries[found].value = value;
+        return false;
+    }
+    if(m_ctrl.empty()) rehash(MIN_CAPACITY);
+    size_t slot = findFree(hash);
+    if(m_ctrl[slot] == CTRL_EMPTY && m_growthLeft == 0){
+        //删除留下的槽太多时原样重建就够了，否则容量翻倍
+        size_t capacity = m_ctrl.size();
+        if(m_count + 1 > (capacity - capacity / 8) / 2) capacity *= 2;
+        rehash(capacity);
+        slot = findFree(hash);
+    }
+    if(m_ctrl[slot] == CTRL_EMPTY) m_growthLeft--;
+    m_ctrl[slot] = tag(hash);
+    m_entries[slot] = MapEntry{key, value};
+    m_count++;
+    return true;
+}
+
+//所在组里还有空槽时，没有查找会越过这一组，可以直接标成空槽；
+//否则要留下删除标记，让探测继续往后走
+bool ObjMap::remove(Value key){
+    long slot = find(key, hashValue(key));
+    if(slot < 0) return false;
+    size_t group = slot / GROUP_SIZE;
+    if(matchEmpty(&m_ctrl[group * GROUP_SIZE]) != 0){
+        m_ctrl[slot] = CTRL_EMPTY;
+        m_growthLeft++;
+    }else{
+        m_ctrl[slot] = CTRL_DELETED;
+    }
+    m_entries[slot] = MapEntry{NIL_VAL, NIL_VAL};
+    m_count--;
+    return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include <iostream>
+#include "chunk.h"
+
+//把编译好的chunk翻译成一个独立的C++翻译单元，每条指令展开成直线代码，跳转变成goto。
+//生成的代码链接runtime库(见runtime.h)，输出和VM::run逐字节一致。
+//只支持没有函数声明的脚本：运行时库没有调用帧，常量里有ObjFunction时直接返回false。
+//遇到无法翻译的指令或没有验证过的chunk也返回false。
+bool emitCpp(const Chunk& chunk, const char* name, std::ostream& out);
@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include "value.h"
+#include "object.h"
+
+#define ARRAY_MAX (1 << 27)     //单个数组最多的元素个数，即1GB的double
+
+//下标检查，VM和AOT运行时共用，散列表在调用前已经单独处理。
+//成功时把下标写进*slot并返回nullptr，否则返回错误消息
+static inline const char* arraySlot(Value array, Value index, size_t* slot){
+    if(!IS_OBJ(array) || !IS_ARRAY(array)) return "Only arrays and maps can be indexed.";
+    double i;
+    if(IS_INT(index)){
+        i = AS_INT(index);
+    }else if(IS_DOUBLE(index) && AS_NUMBER(index) == floor(AS_NUMBER(index))){
+        i = AS_NUMBER(index);
+    }else{
+        return "Array index must be an integer.";
+    }
+    if(i < 0 || i >= (double)AS_ARRAY(array)->m_values.size()) return "Array index out of bounds.";
+    *slot = (size_t)i;
+    return nullptr;
+}
+
+//批量运算的内核：按AVX2(4个double)或SSE2(2个double)一块块处理，剩余的逐个处理。
+//求和与点积用多个累加器，加法的顺序和逐个相加不同，结果可能差最后几位。
+//数组里有NaN时，最小值、最大值都是NaN
+double arraySum(const double* a, size_t n);
+double arrayMin(const double* a, size_t n);     //n必须大于0
+double arrayMax(const double* a, size_t n);     //n必须大于0
+double arrayDot(const double* a, const double* b, size_t n);
+void arrayScale(double* a, size_t n, double k);     //a[i] *= k
+void arrayAdd(double* a, const double* b, size_t n);    //a[i] += b[i]
+void arraySort(double* a, size_t n);    //升序，NaN排在最后
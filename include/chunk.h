@@ -2,6 +2,7 @@
 #include <vector>
 #include <iostream>
 #include <iomanip>
+#include <assert.h>
 #include "common.h"
 #include "value.h"
 
@@ -9,6 +10,7 @@
 
 typedef enum{
     OP_CONSTANT,
+    OP_CONSTANT_LONG,   //_LONG形式的操作数是三字节大端常量下标，常量超过256个时使用
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
@@ -16,8 +18,11 @@ typedef enum{
     OP_GET_LOCAL,
     OP_SET_LOCAL,
     OP_GET_GLOBAL,
+    OP_GET_GLOBAL_LONG,
     OP_DEFINE_GLOBAL,
+    OP_DEFINE_GLOBAL_LONG,
     OP_SET_GLOBAL,
+    OP_SET_GLOBAL_LONG,
     OP_EQUAL,
     OP_GREATER,
     OP_LESS,
@@ -27,30 +32,194 @@ typedef enum{
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    OP_GREATER_NUM,     //_NUM形式由类型推断换上，操作数已证明是数字，执行时不再检查
+    OP_LESS_NUM,
+    OP_ADD_NUM,
+    OP_SUBTRACT_NUM,
+    OP_MULTIPLY_NUM,
+    OP_DIVIDE_NUM,
+    OP_NEGATE_NUM,
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,
+    OP_CALL,        //操作数是实参个数，被调用者在实参下面
+    OP_GET_INDEX,   //栈上是数组和下标
+    OP_SET_INDEX,   //栈上是数组、下标和新值，新值留在栈上
+    OP_MAP,         //操作数是键值对个数，键值对依次在栈上
+    OP_IN,          //栈上是键和散列表，结果是bool
+    OP_DELETE,      //栈上是散列表和键，都弹出
+    OP_FOR_TEST,    //计数for循环：比较局部变量和上界，不满足则跳出
+    OP_FOR_STEP,    //计数for循环：局部变量加步长并跳回OP_FOR_TEST，步长是常量(减法时已取负)
+    OP_JUMP_TABLE,  //switch的值都是稠密的整数：减去下界直接索引跳转表
+    OP_CASE_TABLE,  //其余的switch：常量里的散列表把值映射成跳转表的下标
     OP_RETURN,  
 } OpCode;
 
+//OP_FOR_TEST的mode字节：低两位是比较方式，FOR_LIMIT_LOCAL表示上界是局部变量槽位，否则是常量下标
+#define FOR_CMP_LESS            0
+#define FOR_CMP_LESS_EQUAL      1
+#define FOR_CMP_GREATER         2
+#define FOR_CMP_GREATER_EQUAL   3
+#define FOR_CMP_MASK            3
+#define FOR_LIMIT_LOCAL         4
+
+//OP_FOR_STEP的mode字节：自增写的是i = i - k时为FOR_STEP_SUBTRACT，只用来选类型错误的提示
+#define FOR_STEP_SUBTRACT       1
+
+#define CONSTANT_LONG_MAX       0xffffff    //一个chunk最多的常量数减一
+
+static inline bool isBranch(uint8_t instruction){
+    return instruction == OP_JUMP || instruction == OP_JUMP_IF_FALSE || instruction == OP_LOOP ||
+           instruction == OP_FOR_TEST || instruction == OP_FOR_STEP;
+}
+
+//跳转指令的目标偏移，操作数是跳转指令之后(向前跳)或之前(向后跳)的16位距离
+static inline int branchTarget(const uint8_t* code, int offset){
+    switch(code[offset]){
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+            return offset + 3 + ((code[offset + 1] << 8) | code[offset + 2]);
+        case OP_LOOP:
+            return offset + 3 - ((code[offset + 1] << 8) | code[offset + 2]);
+        case OP_FOR_TEST:
+            return offset + 6 + ((code[offset + 4] << 8) | code[offset + 5]);
+        default:    //OP_FOR_STEP
+            return offset + 6 - ((code[offset + 4] << 8) | code[offset + 5]);
+    }
+}
+
+//switch的分派指令，弹出栈顶的值后跳到选中的分支：
+//  OP_JUMP_TABLE  count:u16 low:i32 table[count + 1]   值为low + i时取第i项
+//  OP_CASE_TABLE  count:u16 constant:u24 table[count + 1]   常量散列表的值是项的下标
+//表项是从指令末尾向回跳的16位距离，最后一项是default。分支体都编译在分派指令之前，
+//没有default时这一项是0，落到指令后面的下一条
+static inline bool isSwitch(uint8_t instruction){
+    return instruction == OP_JUMP_TABLE || instruction == OP_CASE_TABLE;
+}
+
+static inline int switchCount(const uint8_t* code, int offset){
+    return (code[offset + 1] << 8) | code[offset + 2];
+}
+
+//跳转表第一项的偏移
+static inline int switchTable(const uint8_t* code, int offset){
+    return offset + (code[offset] == OP_JUMP_TABLE ? 7 : 6);
+}
+
+static inline int switchLength(const uint8_t* code, int offset){
+    return switchTable(code, offset) - offset + 2 * (switchCount(code, offset) + 1);
+}
+
+//第entry项的目标偏移，entry为switchCount时是default
+static inline int switchTarget(const uint8_t* code, int offset, int entry){
+    int end = offset + switchLength(code, offset);
+    int at = switchTable(code, offset) + 2 * entry;
+    return end - ((code[at] << 8) | code[at + 1]);
+}
+
+//操作码加操作数的字节数，不认识的操作码返回0。验证器和类型推断按它逐条解码。
+//switch的分派指令只算跳转表前面的固定部分，整条的长度见instructionSize
+static inline int instructionLength(uint8_t instruction){
+    switch(instruction){
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_CALL:
+        case OP_MAP:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+            return 3;
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG:
+            return 4;
+        case OP_FOR_TEST:
+        case OP_FOR_STEP:
+        case OP_CASE_TABLE:
+            return 6;
+        case OP_JUMP_TABLE:
+            return 7;
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_ADD_NUM:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+        case OP_NEGATE_NUM:
+        case OP_PRINT:
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+        case OP_IN:
+        case OP_DELETE:
+        case OP_RETURN:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+//整条指令的字节数，code必须已经通过验证
+static inline int instructionSize(const uint8_t* code, int offset){
+    return isSwitch(code[offset]) ? switchLength(code, offset) : instructionLength(code[offset]);
+}
+
 class Chunk{
     std::vector<uint8_t>    m_code;         //操作码数组
     std::vector<Value>      m_constants;    //常量数组
     std::vector<int>        m_lines;        //代码行数
+    std::vector<Obj*>       m_owned;        //冻结后常量里的对象归chunk所有，不在任何VM的堆上
+    bool                    m_frozen;       //冻结后只读，可以被多个线程上的VM同时执行
+    int                     m_maxStack;     //验证器算出的最大栈深度，-1表示没有验证过
+
+    void copyFrom(const Chunk& source);     //freeze()复制函数的chunk用，只复制未冻结的chunk
 
 public:
     Chunk();
     ~Chunk();
+    //冻结的chunk在析构时删除m_owned里的对象，默认的复制会让两个chunk删同一批对象
+    Chunk(const Chunk&) = delete;
+    Chunk& operator=(const Chunk&) = delete;
     void writeChunk(uint8_t byte, int line);  
+    void writeCode(const uint8_t* code, int count, int line);  //一次写入同一行的count个字节
     int addConstant(Value value);   //添加常数
 
     int getCount() const;
     int getLine(int offset) const;
     Value getConstant(int offset) const;
+    int getConstantCount() const;
     uint8_t* getFirstCode() const;
     uint8_t getCode(int offset) const;
     uint8_t getInstruction(int offset) const;
+    int getLong(int offset) const;  //读_LONG指令的三字节操作数
 
     void changeCode(int offset, uint8_t content);
+
+    //把常量里的字符串复制成chunk自己的只读副本，之后chunk不再引用编译它的VM
+    void freeze();
+    bool isFrozen() const;
+
+    //由verifyChunk设置，修改字节码或常量后失效，VM只执行验证过的chunk
+    void setMaxStack(int depth);
+    int getMaxStack() const;
+    bool isVerified() const;
 };
\ No newline at end of file
@@ -4,8 +4,11 @@
 #include <stddef.h>
 #include <stdint.h>
 
+//make release定义CPPLOX_RELEASE，关掉反汇编和逐条跟踪
+#ifndef CPPLOX_RELEASE
 #define DEBUG_PRINT_CODE
 
 #define DEBUG_TRACE_EXECUTION
+#endif
 
 #define UINT8_COUNT (UINT8_MAX + 1)
\ No newline at end of file
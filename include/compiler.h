@@ -1,7 +1,11 @@
 #pragma once
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 #include "common.h"
 #include "chunk.h"
+#include "object.h"
 #include "scanner.h"
 
 typedef enum {
@@ -32,8 +36,36 @@ typedef struct {
 typedef struct{
     Token name;
     int depth;      //声明局部变量的代码块深度
+    int shadowed;   //被它遮蔽的同名外层局部变量的下标，没有则为-1
 } Local;
 
+typedef enum{
+    TYPE_FUNCTION,
+    TYPE_SCRIPT     //顶层代码
+} FunctionType;
+
+//每个函数各自的编译状态。编译嵌套的函数时，外层函数的状态换出来暂存在这里，编译完再换回去
+typedef struct{
+    ObjFunction* function;
+    FunctionType type;
+    Chunk* chunk;
+    Local locals[UINT8_COUNT];
+    int localCount;
+    int scopeDepth;
+    std::unordered_map<std::string_view, int> localIndex;
+    std::unordered_map<std::string_view, int> identifiers;
+} FunctionState;
+
+//switch里的一个case值，body是它所在的分支体的序号
+typedef struct{
+    Value value;
+    int body;
+    Token token;    //值的记号，分派指令在switch末尾生成，重复的值在这里报错
+} CaseLabel;
+
+//switch的跳转表，值都是整数、分布足够密时才用OP_JUMP_TABLE
+#define SWITCH_MIN_DENSITY 2    //值的范围最多是case值个数的几倍
+
 class Compiler{
     Token m_current;
     Token m_previous;
@@ -41,11 +73,18 @@ class Compiler{
     bool m_panicMode;
     Scanner *m_sc;
     Chunk *m_chunk;
+    VM *m_vm;       //字符串常量驻留到这个VM
     static ParseRule m_rules[];
 
     Local m_locals[UINT8_COUNT];
     int m_localCount;     //作用域中有多少局部变量
     int m_scopeDepth;     //作用域深度，正在编译的当前代码外围的代码块数量
+    std::unordered_map<std::string_view, int> m_localIndex;    //名字 -> 最内层同名局部变量的下标
+    std::unordered_map<std::string_view, int> m_identifiers;   //全局变量名 -> 常量下标，每个名字只占一个常量
+    ObjFunction* m_function;    //正在编译的函数，顶层代码为nullptr
+    FunctionType m_type;
+    std::vector<FunctionState*> m_enclosing;    //外层函数的状态，最外层在前
+    int m_lastGetIndex;     //最近一条OP_GET_INDEX的位置，delete语句用
 
 private:
     void advance(); //取下一个token，判断是否出错
@@ -63,6 +102,8 @@ private:
     void emitLoop(int loopStart);
     int  emitJump(uint8_t instruction);
     void emitConstant(Value value);
+    void emitConstantOp(uint8_t op, uint8_t longOp, int index);    //下标超过255时发出_LONG形式
+    int  makeConstant(Value value);
     void emitReturn();
 
     void patchJump(int offset);
@@ -74,12 +115,17 @@ private:
     void literal(bool canAssign);
     void and_(bool canAssign);
     void or_(bool canAssign);
+    void call(bool canAssign);
+    void index(bool canAssign);
+    void mapLiteral(bool canAssign);
+    uint8_t argumentList();
 
     ParseRule* getRule(TokenType type);
     void number(bool canAssign); //指向下面函数的指针
+    Value numberValue(const Token& token);
     void string(bool canAssign);
     void parsePrecedence(Precedence precedence); //解析给定优先级和更高优先级的表达式
-    uint8_t identifierConstant(Token* name);    //chunk写入标识符的constant(Value类型)，返回下标
+    int identifierConstant(Token* name);    //chunk写入标识符的constant(Value类型)，返回下标
     bool identifiersEqual(Token* a, Token* b);
     int resolveLocal(Token* name);
     void expression();
@@ -87,28 +133,38 @@ private:
     void block();
     void beginScope();
     void endScope();
+    void swapState(FunctionState* state);
+    void function();
 
     void addLocal(Token name);
     void declareVariable();  //声明局部变量
     void varDeclaration();   //变量声明解析
+    void funDeclaration();
     void namedVariable(Token name, bool canAssign);   //变量访问，解析已定义的变量
     void variable(bool canAssign);
-    uint8_t parseVariable(const char* errorMessage);
+    int parseVariable(const char* errorMessage);
     void markInitialized();
-    void defineVariable(uint8_t global);
+    void defineVariable(int global);
 
     void expressionStatement();
     void forStatement();
+    bool countedFor();
     void ifStatement();
     void printStatement();
+    void deleteStatement();
+    void returnStatement();
     void whileStatement();
+    void switchStatement();
+    Value caseLabel();
+    void emitSwitch(std::vector<CaseLabel>& labels, const std::vector<int>& bodies, int defaultStart);
     void declaration();
     void statement();
 
     void endCompiler();
 
 public:
-    Compiler(const std::string& source, Chunk* chunk);
+    Compiler(VM* vm, const std::string& source, Chunk* chunk);
+    Compiler(VM* vm, const char* source, size_t length, Chunk* chunk);
     ~Compiler();
 
     bool compile();
@@ -1,5 +1,5 @@
 #pragma once
 #include "chunk.h"
 
-void disassembleChunk(const Chunk& chunk, const char* name);
-int disassembleInstruction(const Chunk& chunk, int offset);
+void disassembleChunk(const Chunk& chunk, const char* name, std::ostream& out = std::cout);
+int disassembleInstruction(const Chunk& chunk, int offset, std::ostream& out = std::cout);
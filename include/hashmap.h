@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+#include "value.h"
+#include "object.h"
+
+//键的散列值：数字按double的位模式(-0和0算同一个)，整数先转成double，
+//这样1和1.0落在同一个槽；字符串用ObjString::hash()，只算一次；其他对象按地址
+uint64_t hashValue(Value key);
+
+//NaN和自己不相等，存进去就再也找不到，不能作为键。合法时返回nullptr
+static inline const char* mapKeyError(Value key){
+    if(IS_DOUBLE(key) && AS_NUMBER(key) != AS_NUMBER(key)) return "Map key cannot be NaN.";
+    return nullptr;
+}
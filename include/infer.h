@@ -0,0 +1,11 @@
+#pragma once
+#include "chunk.h"
+
+class ObjFunction;
+
+//局部变量的类型推断，在verifyChunk通过之后做，函数常量的chunk也递归处理。
+//沿所有路径推算每个栈槽位(局部变量和临时值)是否一定是数字，汇合处取交集，循环时迭代到不再变化。
+//两个操作数都证明是数字的算术和比较换成_NUM操作码，其余保持原样。
+//_NUM操作码和原来的栈效果相同，chunk仍然是验证过的
+void specializeNumbers(Chunk* chunk);
+void specializeFunction(ObjFunction* function);     //和verifyFunction一样只处理函数自己的chunk
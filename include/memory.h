@@ -0,0 +1,50 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+//Obj的分级内存池。按对象大小分成几个尺寸级别，每级从64KB的slab里切固定大小的槽，
+//释放的槽挂在该级的空闲链表上复用。VM销毁时整块释放slab，不逐个delete。
+#define POOL_SLAB_SIZE  (64 * 1024)
+#define POOL_CLASS_COUNT 4          //32 64 128 256字节
+#define POOL_MAX_SLOT   256         //所有Obj类型都不超过最大的槽，见object.cpp里的static_assert
+
+typedef struct{
+    size_t slotSize;        //槽大小
+    size_t slabs;           //已申请的slab数
+    size_t allocations;     //累计分配次数
+    size_t frees;           //累计释放次数
+    size_t live;            //当前存活的对象数
+} PoolStats;
+
+class ObjPool{
+    typedef struct FreeSlot{
+        struct FreeSlot* next;
+    } FreeSlot;
+
+    typedef struct{
+        FreeSlot* freeList;
+        char* bump;             //当前slab中还没切过的部分
+        char* bumpEnd;
+        std::vector<char*> slabs;
+        PoolStats stats;
+    } SizeClass;
+
+    SizeClass m_classes[POOL_CLASS_COUNT];
+
+private:
+    static int classIndex(size_t size);
+
+public:
+    ObjPool();
+    ~ObjPool();
+    ObjPool(const ObjPool&) = delete;
+    ObjPool& operator=(const ObjPool&) = delete;
+
+    void* allocate(size_t size);    //size不超过POOL_MAX_SLOT
+    void release(void* pointer, size_t size);
+    void releaseAll();      //整块归还所有slab，调用前对象的析构函数必须已经执行
+
+    int classCount() const;
+    const PoolStats& classStats(int index) const;
+};
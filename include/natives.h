@@ -0,0 +1,31 @@
+#pragma once
+#include "common.h"
+#include "value.h"
+#include "object.h"
+
+//内置原生函数：clock、数学函数、字符串工具、按行读文件和数组的批量运算，VM构造时注册成全局变量
+void defineNatives(VM* vm);
+
+//出错时调用：把格式化后的错误消息作为字符串放进*result，返回false
+bool nativeError(VM* vm, Value* result, const char* format, ...);
+
+//调用约定见ObjNative。参数个数和数字签名的类型检查在这里统一做，
+//纯数字的函数不经过Value直接拿double
+static inline bool callNative(VM* vm, ObjNative* native, int argCount, Value* args, Value* result){
+    if(native->m_arity != -1 && argCount != native->m_arity){
+        return nativeError(vm, result, "Expected %d arguments but got %d.", native->m_arity, argCount);
+    }
+    switch(native->m_kind){
+        case NATIVE_NUMBER1:
+            if(!IS_NUMBER(args[0])) break;
+            *result = NUMBER_VAL(native->as.number1(AS_NUMBER(args[0])));
+            return true;
+        case NATIVE_NUMBER2:
+            if(!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) break;
+            *result = NUMBER_VAL(native->as.number2(AS_NUMBER(args[0]), AS_NUMBER(args[1])));
+            return true;
+        default:
+            return native->as.function(vm, argCount, args, result);
+    }
+    return nativeError(vm, result, "Arguments to '%s' must be numbers.", native->m_name.c_str());
+}
@@ -1,24 +1,45 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <string_view>
 #include <iostream>
 #include "common.h"
 #include "value.h"
+#include "chunk.h"
+#include "source.h"
 
 //取obj的类型
 #define OBJ_TYPE(value)        (AS_OBJ(value)->m_type)
 
 //接收Value，因为虚拟机中都用的Value
 #define IS_STRING(value)       AS_OBJ(value)->isObjType(OBJ_STRING)
+#define IS_NATIVE(value)       AS_OBJ(value)->isObjType(OBJ_NATIVE)
+#define IS_FUNCTION(value)     AS_OBJ(value)->isObjType(OBJ_FUNCTION)
+#define IS_ARRAY(value)        AS_OBJ(value)->isObjType(OBJ_ARRAY)
+#define IS_MAP(value)          AS_OBJ(value)->isObjType(OBJ_MAP)
+#define IS_READER(value)       AS_OBJ(value)->isObjType(OBJ_READER)
 
 //接收Value
 #define AS_STRING(value)       ((ObjString*)AS_OBJ(value)) //返回ObjString指针
-#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->m_string) //返回ObjString下的string
+#define AS_CSTRING(value)      (((ObjString*)AS_OBJ(value))->view())   //返回ObjString字符的只读视图，借用的字符串也适用
+#define AS_NATIVE(value)       ((ObjNative*)AS_OBJ(value))
+#define AS_FUNCTION(value)     ((ObjFunction*)AS_OBJ(value))
+#define AS_ARRAY(value)        ((ObjArray*)AS_OBJ(value))
+#define AS_MAP(value)          ((ObjMap*)AS_OBJ(value))
+#define AS_READER(value)       ((ObjReader*)AS_OBJ(value))
 
 typedef enum{
     OBJ_STRING,
+    OBJ_NATIVE,
+    OBJ_FUNCTION,
+    OBJ_ARRAY,
+    OBJ_MAP,
+    OBJ_READER,
     OBJ
 }ObjType;
 
+#define OBJ_TYPE_COUNT OBJ     //具体对象类型的个数，OBJ本身只是基类的标记
+
 class Obj{
 public:
     ObjType m_type;
@@ -32,22 +53,161 @@ public:
     }
 };
 
+//FNV-1a，算一次存在ObjString里
+uint32_t hashString(const char* chars, size_t length);
+
+//字符串的字符一般在m_string里，创建后不再修改。reader的当前行是借用的：m_chars直接指向
+//映射区，m_string为空，下一次readLine时改指下一行，所以存进散列表前要先用keepString复制
 class ObjString: public Obj{
 public:
-    std::string m_string;
+    std::string m_string;   //自有的字符，驻留表里的键直接指向它
+    const char* m_chars;    //字符的起点，自有时指向m_string
     int m_length;
+    uint32_t m_hash;        //m_hashed为true时有效
+    bool m_hashed;          //驻留的和冻结的字符串创建时就算好，其余的第一次用作散列表的键时才算
+    bool m_borrowed;        //字符借自别的对象，内容会变
 
     ObjString();
     ObjString(const char* chars, int length);
     virtual ~ObjString();
+
+    std::string_view view() const { return std::string_view(m_chars, m_length); }
+    uint32_t hash(){
+        if(!m_hashed){
+            m_hash = hashString(m_chars, m_length);
+            m_hashed = true;
+        }
+        return m_hash;
+    }
+    void own(){ m_chars = m_string.data(); }   //m_string写好之后调用
+    void borrow(const char* chars, int length);
+};
+
+//原生函数的一般形式：args直接指向值栈上的第一个实参，不复制。
+//出错时返回false，*result里放错误消息字符串，由VM报告运行时错误
+typedef bool (*NativeFn)(VM* vm, int argCount, Value* args, Value* result);
+//纯数字签名：VM检查实参都是数字后直接传double，函数里不用再逐个判断类型
+typedef double (*NativeNumber1)(double);
+typedef double (*NativeNumber2)(double, double);
+
+typedef enum{
+    NATIVE_GENERIC,
+    NATIVE_NUMBER1,
+    NATIVE_NUMBER2
+}NativeKind;
+
+class ObjNative: public Obj{
+public:
+    std::string m_name;
+    NativeKind m_kind;
+    int m_arity;        //实参个数，-1表示不定，只有一般形式可以不定
+    union{
+        NativeFn function;
+        NativeNumber1 number1;
+        NativeNumber2 number2;
+    }as;
+
+    ObjNative();
+    virtual ~ObjNative();
+};
+
+//用户定义的函数，编译后作为常量放在外层chunk里。没有闭包，不捕获外层的局部变量
+class ObjFunction: public Obj{
+public:
+    int m_arity;
+    Chunk m_chunk;
+    ObjString* m_name;
+
+    ObjFunction();
+    virtual ~ObjFunction();
+};
+
+//定长的数字数组，元素是连续存放、不装箱的double，批量运算见arrays.h
+class ObjArray: public Obj{
+public:
+    std::vector<double> m_values;
+
+    ObjArray();
+    virtual ~ObjArray();
 };
 
-ObjString* copyString(const char* chars, int length);
+typedef struct{
+    Value key;
+    Value value;
+} MapEntry;
+
+//散列表，Swiss table式的开放寻址，实现见hashmap.cpp。
+//每个槽一个控制字节：空、已删除，或键的散列值的低7位。控制字节16个一组，
+//查找时一条SIMD比较就筛出一组里可能匹配的槽，只对这些槽比较键。
+//键按valuesEqual比较：整数和double相等就是同一个键，字符串按内容比较
+class ObjMap: public Obj{
+public:
+    std::vector<int8_t> m_ctrl;
+    std::vector<MapEntry> m_entries;
+    size_t m_count;
+    size_t m_growthLeft;    //还能占用几个空槽，用完就扩容，保证每次查找都能遇到空槽停下
+
+    ObjMap();
+    virtual ~ObjMap();
+    bool get(Value key, Value* value) const;
+    bool set(Value key, Value value);   //新插入的键返回true
+    bool remove(Value key);     //键不存在时返回false
+
+private:
+    long find(Value key, uint64_t hash) const;
+    size_t findFree(uint64_t hash) const;
+    void rehash(size_t capacity);
+};
+
+//按行读文件，open()创建。文件用SourceFile映射进来，按行扫描换行符
+class ObjReader: public Obj{
+public:
+    std::string m_path;
+    SourceFile m_file;
+    ObjString* m_line;  //每次readLine都返回这个对象，借用映射区里的当前行
+    size_t m_offset;    //下一行的起点
+    size_t m_released;  //[0, m_released)已经还给内核
+    bool m_open;
+
+    ObjReader();
+    virtual ~ObjReader();
+};
+
+//字符串驻留表的键：指向ObjString自己的字符，散列值用创建时算好的m_hash，不再重算
+typedef struct{
+    std::string_view chars;
+    uint32_t hash;
+} StringKey;
+
+struct StringKeyHash{
+    size_t operator()(const StringKey& key) const { return key.hash; }
+};
+
+static inline bool operator==(const StringKey& a, const StringKey& b){
+    return a.hash == b.hash && a.chars == b.chars;
+}
+
+//从一段字符创建(驻留)字符串，已经驻留过时直接返回，不分配内存
+ObjString* copyString(VM* vm, const char* chars, int length);
+
+//不驻留的字符串：split、substr这类大量、多半只用一次的结果用，不在驻留表里留一项，也先不算散列值
+ObjString* allocateString(VM* vm, const char* chars, int length);
+
+//借用的字符串换成自有的副本，其余的值原样返回
+Value keepString(VM* vm, Value value);
+//脚本往散列表里存值都经过这里：借用的值总是复制，借用的键只在新插入时复制
+void mapSet(VM* vm, ObjMap* map, Value key, Value value);
+
+void printObject(Value value, std::ostream& out = std::cout);
+
+Obj* allocateObj(VM* vm, ObjType type);
+
+size_t objectSize(ObjType type);
 
-void printObject(Value value);
+const char* objTypeName(ObjType type);
 
-Obj* allocateObj(ObjType type);
+void freeObject(VM* vm, Obj* object);
 
-ObjString* makeString(std::string s, int length);
+ObjString* makeString(VM* vm, std::string s, int length);
 
-void freeObjects();
\ No newline at end of file
+void freeObjects(VM* vm);
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class VM;
+class Chunk;
+class ObjFunction;
+
+//SIGPROF采样分析器。setitimer按进程CPU时间定时发信号，信号处理函数找到当前线程
+//正在执行的VM，读出它的调用栈和当前行，累加到VM预先分配好的ProfileTable里，不做别的事。
+//run()返回后VM再把表里的栈折叠成文本，合并进全进程的结果。解释循环里没有任何插桩，开销只有信号本身
+#define PROFILE_HZ      1000
+#define PROFILE_DEPTH   16          //每个样本最多记录的调用层数，更深的只保留最内层
+#define PROFILE_SLOTS   4096        //每个VM最多记录的不同(调用栈, 行)个数，必须是2的幂
+
+typedef struct{
+    uint64_t count;                 //0表示空槽
+    uint64_t hash;
+    const Chunk* chunk;             //最内层帧正在执行的chunk
+    int line;
+    int depth;                      //调用深度，可能大于PROFILE_DEPTH
+    const ObjFunction* frames[PROFILE_DEPTH];   //frames[0]是最内层的函数，顶层脚本为nullptr
+} ProfileSample;
+
+//开放寻址的计数表，add在信号处理函数里调用，只读写预先分配好的内存
+class ProfileTable{
+    std::vector<ProfileSample> m_slots;
+    uint64_t m_dropped;     //表满时丢弃的样本数
+
+public:
+    ProfileTable();
+    void reserve();         //开始采样前在普通上下文里分配
+    void add(const ProfileSample& sample);
+    void clear();
+    const std::vector<ProfileSample>& slots() const { return m_slots; }
+    uint64_t dropped() const { return m_dropped; }
+};
+
+bool startProfiler(int hz = PROFILE_HZ);    //安装SIGPROF处理函数并启动定时器
+void stopProfiler();
+bool profilerRunning();
+
+void profilerEnter(VM* vm);     //当前线程开始执行vm，之后的样本记到它上面
+void profilerLeave();
+
+void profilerAddSamples(const std::string& stack, uint64_t count);
+void profilerAddDropped(uint64_t count);
+//按flamegraph.pl/speedscope接受的折叠栈格式输出："帧;帧;帧 样本数"，每行一个栈
+bool writeProfile(const std::string& path);
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include <iostream>
+#include "chunk.h"
+
+//执行飞行记录器：环形缓冲区里保存最近RECORDER_SIZE条已执行指令的紧凑记录，
+//始终开启，出错时再用disassembleInstruction解码。比DEBUG_TRACE_EXECUTION便宜得多，
+//每条指令只多一次16字节的写入
+#define RECORDER_SIZE   256         //必须是2的幂
+#define RECORD_EMPTY    0xff        //执行这条指令前栈是空的
+
+typedef struct{
+    const Chunk* chunk; //指令所在的chunk，每个函数有自己的chunk
+    uint32_t offset;    //指令在chunk中的偏移
+    uint8_t  opcode;
+    uint8_t  top;       //执行前栈顶值的ValueType，栈空为RECORD_EMPTY
+} Record;
+
+class FlightRecorder{
+    Record   m_records[RECORDER_SIZE];
+    uint64_t m_count;   //累计记录条数，下一条写到m_count % RECORDER_SIZE
+
+public:
+    FlightRecorder();
+
+    void record(const Chunk* chunk, uint32_t offset, uint8_t opcode, uint8_t top){
+        m_records[m_count++ & (RECORDER_SIZE - 1)] = Record{chunk, offset, opcode, top};
+    }
+    void clear();
+    //从旧到新输出记录，每条先打印栈顶类型，再反汇编对应的指令。
+    //记录里的chunk必须都还有效，也就是只能在脚本运行中或暂停时调用
+    void dump(std::ostream& out) const;
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include <initializer_list>
+#include "common.h"
+#include "value.h"
+#include "object.h"
+#include "vm.h"
+
+//--emit-cpp生成的C++代码链接的运行时库。
+//生成的代码自己维护值栈，对象、字符串驻留、全局变量和输出仍然交给VM，
+//错误信息和VM::run的格式完全一致。
+class Runtime{
+    VM m_vm;
+    std::vector<Value> m_stack;
+
+public:
+    Runtime();
+    ~Runtime();
+
+    Value* stack(size_t size);
+    Value string(const char* chars, int length);
+    Value caseTable(std::initializer_list<Value> entries);     //switch的分支表，键和值交替
+
+    bool getGlobal(Value name, Value* value, int line);
+    void defineGlobal(Value name, Value value);
+    bool setGlobal(Value name, Value value, int line);
+    bool add(Value a, Value b, Value* result, int line);
+    bool call(Value* sp, int argCount, int line);  //结果写在被调用者所在的槽上
+    bool getIndex(Value array, Value index, Value* result, int line);
+    bool setIndex(Value array, Value index, Value value, int line);
+    bool map(Value* sp, int count, int line);     //散列表写在第一个键所在的槽上
+    bool contains(Value key, Value map, Value* result, int line);
+    bool remove(Value map, Value key, int line);
+    void print(Value value);
+    void error(int line, const char* format, ...);
+
+    int run(InterpretResult (*script)(Runtime&));    //返回进程退出码
+};
+
+static inline bool aotIsFalsey(Value value){
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+//生成代码中每条指令展开用的宏，sp指向栈顶之上的空位
+#define AOT_BINARY(op, line) \
+    do{ \
+        if(!IS_NUMBER(sp[-1]) || !IS_NUMBER(sp[-2])){ \
+            rt.error(line, "Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        sp[-2] = op(sp[-2], sp[-1]); \
+        sp--; \
+    }while(false)
+
+//类型推断证明操作数都是数字时的不检查版本
+#define AOT_NUMBER(op) \
+    do{ \
+        sp[-2] = op(sp[-2], sp[-1]); \
+        sp--; \
+    }while(false)
+
+#define AOT_ADD(line) \
+    do{ \
+        if(!rt.add(sp[-2], sp[-1], &sp[-2], line)) return INTERPRET_RUNTIME_ERROR; \
+        sp--; \
+    }while(false)
+
+#define AOT_NEGATE(line) \
+    do{ \
+        if(!IS_NUMBER(sp[-1])){ \
+            rt.error(line, "Operand must be a number."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        sp[-1] = numberNegate(sp[-1]); \
+    }while(false)
+
+#define AOT_MAIN(script) \
+    int main(){ \
+        Runtime rt; \
+        return rt.run(script); \
+    }
@@ -6,8 +6,9 @@ typedef enum {
     // Single-character tokens. 单字符词法
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
-    TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
+    TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR, TOKEN_COLON,
     // One or two character tokens. 一或两字符词法
     TOKEN_BANG, TOKEN_BANG_EQUAL,
     TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
@@ -16,9 +17,9 @@ typedef enum {
     // Literals. 字母量
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
     // Keywords. 关键字
-    TOKEN_AND, TOKEN_CLASS, TOKEN_ELSE, TOKEN_FALSE,
-    TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
-    TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
+    TOKEN_AND, TOKEN_CASE, TOKEN_CLASS, TOKEN_DEFAULT, TOKEN_DELETE, TOKEN_ELSE, TOKEN_FALSE,
+    TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_IN, TOKEN_NIL, TOKEN_OR,
+    TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_SWITCH, TOKEN_THIS,
     TOKEN_TRUE, TOKEN_VAR, TOKEN_WHILE,
 
     TOKEN_ERROR, TOKEN_EOF
@@ -34,6 +35,7 @@ typedef struct{
 class Scanner{
     const char* m_start;      //指向的值不能变，可变更指向对象。
     const char* m_current;
+    const char* m_end;        //源码末尾，*m_end是'\0'，SIMD按块扫描时不越过它
     int m_line;
 
 private:
@@ -47,12 +49,12 @@ private:
     bool match(char expected);
     void skipWhitespace();
     Token number();
-    Token identifier();     //利用字典树(状态机)来判断是否是标识符或关键字
-    TokenType identifierType();     
-    TokenType checkKeyword(int start, int length, const char* rest, TokenType type);
+    Token identifier();
+    TokenType identifierType();     //查关键字的完美散列表，判断是否是关键字
 
 public:
     Scanner(const std::string& source);
+    Scanner(const char* source, size_t length);
     ~Scanner();
 
     Token scanToken();
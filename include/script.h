@@ -0,0 +1,16 @@
+#pragma once
+#include <memory>
+#include "chunk.h"
+
+//编译好的脚本句柄，内部是冻结的chunk。
+//拷贝只增加引用计数，可以在多个VM、多个线程上反复执行，不会重新编译或重新驻留字符串
+class Script{
+    std::shared_ptr<const Chunk> m_chunk;
+
+public:
+    Script();
+    explicit Script(std::shared_ptr<const Chunk> chunk);
+
+    bool isValid() const;
+    const Chunk& getChunk() const;
+};
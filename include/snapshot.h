@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+//堆快照的文件格式，读写见VM::saveSnapshot/VM::loadSnapshot(snapshot.cpp)。
+//对象之间用快照里的编号引用，不存指针，加载到哪个地址都可以。
+//数字按写入时机器的字节序原样存放，头部的字节序标记对不上时拒绝加载
+//
+//  头部      magic[8] version:u32 byteOrder:u32 objectCount:u32 globalCount:u32
+//  对象      type:u8 size:u32 内容[size]，共objectCount个，编号从0开始
+//    字符串    字符
+//    原生函数  名字，加载时换成本VM里注册的同名函数
+//    函数      arity:u32 name:u32 codeCount:u32 code[codeCount]
+//              runCount:u32 (line:u32 count:u32)[runCount]   连续相同的行号压成一段
+//              constantCount:u32 值[constantCount]
+//    数组      double[size / 8]
+//    散列表    count:u32 (键 值)[count]
+//  全局变量  (nameLength:u32 name 值)[globalCount]
+//  值        type:u8，后面是bool:u8 / double / int32 / 对象编号:u32，nil没有内容
+#define SNAPSHOT_MAGIC          "LOXSNAP"   //连同结尾的'\0'共8字节
+#define SNAPSHOT_MAGIC_SIZE     8
+#define SNAPSHOT_VERSION        3   //操作码编号变化时加一
+#define SNAPSHOT_BYTE_ORDER     0x01020304u
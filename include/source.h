@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <stddef.h>
+
+//只读加载脚本源码。普通文件直接mmap，token指向映射区，不拷贝；
+//映射区后面紧跟一页匿名零页，保证data()[size()]是Scanner::isAtEnd需要的'\0'。
+//管道等无法映射的文件退回到读入m_buffer。
+class SourceFile{
+    const char* m_data;
+    size_t m_size;
+    void* m_map;        //mmap的起始地址，没有映射时为nullptr
+    size_t m_mapSize;
+    std::string m_buffer;
+
+private:
+    bool mapFile(int fd, size_t size);
+    bool readFile(int fd);
+
+public:
+    SourceFile();
+    ~SourceFile();
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    const char* data() const;
+    size_t size() const;
+    //顺序处理大文件时，[from, to)已经用完：解除这段页和进程的关联，映射部分的RSS不随文件变大。
+    //页缓存本身由内核管理。只对映射的文件有效，以后再访问这段会重新从文件读入
+    void release(size_t from, size_t to);
+};
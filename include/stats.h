@@ -0,0 +1,21 @@
+#pragma once
+#include <iostream>
+#include <stdint.h>
+#include <stddef.h>
+#include "object.h"
+
+//VM常开的运行计数，开销只有几次自增和比较。
+//扫描器按需给编译器产出token，扫描和编译是同一遍，compileNs包含两者
+typedef struct{
+    uint64_t compileNs;         //扫描+编译耗时
+    uint64_t executeNs;         //run()的墙钟时间
+    uint64_t instructions;      //执行的指令条数
+    size_t   reservedStack;     //值栈预留到的最大深度：每帧按验证器算出的上限预留，不是实际压到的深度
+    size_t   chunkBytes;        //最近一次编译出的字节码大小
+    size_t   constants;         //最近一次编译出的常量个数
+    size_t   internedStrings;   //字符串驻留表大小
+    size_t   objects[OBJ_TYPE_COUNT];       //按类型统计分配的对象数
+    size_t   objectBytes[OBJ_TYPE_COUNT];   //按类型统计分配的字节数(对象本身+字符内容)
+} VMStats;
+
+void printStatsJson(const VMStats& stats, std::ostream& out);
@@ -0,0 +1,12 @@
+#pragma once
+#include <stddef.h>
+
+//字符串原生函数用的内核，按字节处理，和std::string一样不关心编码。
+//SIMD部分和扫描器一样按AVX2(32字节)或SSE2(16字节)一块块比较，剩余部分逐字节处理
+
+//needle在haystack里第一次出现的位置，没有时返回nullptr。needle为空时返回haystack
+const char* findText(const char* haystack, size_t length, const char* needle, size_t needleLength);
+
+//只转换ASCII字母，原地修改
+void upperText(char* chars, size_t length);
+void lowerText(char* chars, size_t length);
@@ -1,15 +1,20 @@
 #pragma once
+#include <iostream>
+#include <stdint.h>
 
 typedef class Obj Obj;
 
 typedef class ObjString ObjString;
 
+class VM;
+
 #define AS_OBJ(value)     ((value).as.obj)
 
 typedef enum {
   VAL_BOOL,
   VAL_NIL, 
   VAL_NUMBER,
+  VAL_INT,      //小整数快速路径，溢出或做除法时提升为VAL_NUMBER，对脚本不可见
   VAL_OBJ
 } ValueType;
 
@@ -19,6 +24,7 @@ typedef struct{
     {
         bool boolean;
         double number;
+        int32_t integer;
         Obj* obj;
     }as;
 }Value;
@@ -27,19 +33,86 @@ typedef struct{
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
-#define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_INT(value)     ((value).type == VAL_INT)
+#define IS_DOUBLE(value)  ((value).type == VAL_NUMBER)
+#define IS_NUMBER(value)  (IS_DOUBLE(value) || IS_INT(value))   //两种表示都是Lox的数字
 
 //取对应的值
 #define AS_BOOL(value)    ((value).as.boolean)
 #define AS_OBJ(value)     ((value).as.obj)
-#define AS_NUMBER(value)  ((value).as.number)
+#define AS_INT(value)     ((value).as.integer)
+#define AS_NUMBER(value)  (IS_INT(value) ? (double)AS_INT(value) : (value).as.number)
 
 //创建Value结构体
 #define BOOL_VAL(value)   ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL           ((Value){VAL_NIL, {.number = 0}})
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 #define NUMBER_VAL(value)   ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value)      ((Value){VAL_INT, {.integer = value}})
+
+//数字运算，调用前两个操作数都必须是数字。
+//两个整数且结果放得下时留在整数上，否则按double计算，结果和全用double时一样
+static inline Value numberAdd(Value a, Value b){
+    int32_t result;
+    if(IS_INT(a) && IS_INT(b) && !__builtin_add_overflow(AS_INT(a), AS_INT(b), &result)){
+        return INT_VAL(result);
+    }
+    return NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+}
+
+static inline Value numberSubtract(Value a, Value b){
+    int32_t result;
+    if(IS_INT(a) && IS_INT(b) && !__builtin_sub_overflow(AS_INT(a), AS_INT(b), &result)){
+        return INT_VAL(result);
+    }
+    return NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+}
+
+static inline Value numberMultiply(Value a, Value b){
+    int32_t result;
+    //0乘负数在double里是-0，整数表示不了
+    if(IS_INT(a) && IS_INT(b) && !__builtin_mul_overflow(AS_INT(a), AS_INT(b), &result) &&
+       (result != 0 || (AS_INT(a) >= 0 && AS_INT(b) >= 0))){
+        return INT_VAL(result);
+    }
+    return NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+}
+
+static inline Value numberDivide(Value a, Value b){
+    return NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b));
+}
+
+//switch按整数分派时取值：整数，或者正好等于一个int32的double(比如4 / 2)
+static inline bool caseInteger(Value value, int32_t* result){
+    if(IS_INT(value)){
+        *result = AS_INT(value);
+        return true;
+    }
+    if(IS_DOUBLE(value) && value.as.number >= INT32_MIN && value.as.number <= INT32_MAX &&
+       (double)(int32_t)value.as.number == value.as.number){
+        *result = (int32_t)value.as.number;
+        return true;
+    }
+    return false;
+}
+
+static inline Value numberNegate(Value a){
+    if(IS_INT(a) && AS_INT(a) != 0 && AS_INT(a) != INT32_MIN){
+        return INT_VAL(-AS_INT(a));
+    }
+    return NUMBER_VAL(-AS_NUMBER(a));
+}
+
+static inline Value numberGreater(Value a, Value b){
+    if(IS_INT(a) && IS_INT(b)) return BOOL_VAL(AS_INT(a) > AS_INT(b));
+    return BOOL_VAL(AS_NUMBER(a) > AS_NUMBER(b));
+}
+
+static inline Value numberLess(Value a, Value b){
+    if(IS_INT(a) && IS_INT(b)) return BOOL_VAL(AS_INT(a) < AS_INT(b));
+    return BOOL_VAL(AS_NUMBER(a) < AS_NUMBER(b));
+}
 
 bool valuesEqual(Value a, Value b);
 
-void printValue(Value value);
\ No newline at end of file
+void printValue(Value value, std::ostream& out = std::cout);
\ No newline at end of file
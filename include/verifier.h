@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include "chunk.h"
+
+class ObjFunction;
+
+//字节码验证器。run()执行时不检查栈越界、局部变量槽位和跳转目标，靠这里事先证明：
+//  每条指令的操作数都在chunk内，常量下标有效，跳转目标落在指令开头；
+//  每条路径上栈深度都不小于0，汇合处的深度相同，局部变量槽位小于当前深度；
+//  每条路径都以OP_RETURN结束，不会执行到chunk末尾之后。
+//通过时把最大栈深度(从帧的槽位0算起)记进chunk，函数常量的chunk也递归验证。
+//失败时error里是第一处错误，chunk保持未验证
+bool verifyChunk(Chunk* chunk, std::string* error);
+
+//只验证函数自己的chunk，常量里的函数不递归，进入时栈上是函数本身和参数。
+//用于不经过编译器得到的函数：堆快照里的函数各自验证，常量之间即使有环也不会无限递归
+bool verifyFunction(ObjFunction* function, std::string* error);
@@ -1,43 +1,127 @@
 #pragma once
+#include <iostream>
+#include <atomic>
 #include "chunk.h"
-#include <stack>
+#include "object.h"
+#include "script.h"
+#include "memory.h"
+#include "stats.h"
+#include "recorder.h"
+#include "profiler.h"
+#include <vector>
 #include <unordered_map>
 #include <unordered_set>
 
+#define FRAMES_MAX 64
+#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+
+//调用栈的一帧，全部放在VM里的定长数组中，调用时不分配内存
+typedef struct{
+    ObjFunction* function;  //顶层脚本为nullptr
+    const Chunk* chunk;
+    uint8_t* ip;            //调用者的返回地址，最内层帧的ip在VM::m_ip里
+    Value* slots;           //这一帧的槽位0在值栈上的位置
+} CallFrame;
+
 typedef enum{
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_YIELD         //指令预算用完，暂停在下一条指令前，用resume()继续
 }InterpretResult;
 
+#define BUDGET_UNLIMITED UINT64_MAX
+
 class VM{
-    Chunk *m_chunk;
+    const Chunk *m_chunk;   //最内层帧的chunk
     uint8_t *m_ip;
-    std::stack<Value> m_stack;
+    Value*  m_slots;        //最内层帧的槽位，局部变量按槽位直接索引
+    CallFrame m_frames[FRAMES_MAX];
+    int     m_frameCount;
+    volatile uint32_t m_frameSeq;   //调用和返回切换m_chunk、m_ip、帧数期间是奇数，SIGPROF采样见到奇数就放弃
+    std::vector<Value> m_stack;     //连续的值栈，所有帧共用
+    Value*  m_stackTop;     //指向栈顶之上的空位
     Obj*    m_objects;
+    ObjPool m_pool;         //本VM所有堆对象的内存
     std::unordered_map<std::string, Value> m_globals;   //后期绑定（编译后分析）
-    std::unordered_map<std::string, Value> m_strings;
+    std::unordered_map<StringKey, ObjString*, StringKeyHash> m_strings;   //字符串驻留表，每个VM一份
+    std::ostream* m_out;    //print语句的输出
+    std::ostream* m_err;    //编译错误和运行时错误
+    VMStats m_stats;
+    Value*  m_stackReserved;    //各帧按验证器算出的最大深度预留到的最高位置
+    uint64_t m_budgetEnd;   //m_stats.instructions数到这里时run()让出
+    Script  m_running;      //execute()暂停期间保持chunk存活
+    FlightRecorder m_recorder;  //最近执行的指令，始终记录
+    bool    m_dumpOnError;  //运行时错误时把飞行记录输出到m_err
+    std::string m_name;     //分析结果里的根帧名
+    ProfileTable m_profile;     //采样分析器开着时，按(调用栈, 行)累计的样本
 
 private:
     InterpretResult run();
     void runtimeError(const char* format, ...);
-    Value peek(int distance);//返回从栈顶起的第几个元素，0是第一个
+    void push(Value value){ *m_stackTop++ = value; }  //帧的最大深度在进入时已经检查过
+    Value pop(){ return *--m_stackTop; }
+    Value peek(int distance){ return m_stackTop[-1 - distance]; }  //返回从栈顶起的第几个元素，0是第一个
     void resetStack();
-    void printTop();
+    bool callValue(Value callee, int argCount);
+    bool call(ObjFunction* function, int argCount);
+    void beginFrameSwitch(){
+        m_frameSeq = m_frameSeq + 1;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+    void endFrameSwitch(){
+        std::atomic_signal_fence(std::memory_order_seq_cst);   //切换的写入都在计数变回偶数之前完成
+        m_frameSeq = m_frameSeq + 1;
+    }
+    bool reserveFrame(Value* slots, const Chunk& chunk);   //从slots起放得下chunk的最大栈深度时返回true
+    bool load(const Chunk& chunk);
+    void foldProfile();
     void concatenate();
 
 public:
     VM();
     ~VM();
 
-    int countString(const char* s);
-    void insertString(const char* s, Value value);
-    Value getString(const char* s);
+    ObjString* findString(const char* chars, size_t length, uint32_t hash);    //没有时返回nullptr
+    void insertString(ObjString* string);
     void changeObjects(Obj* object);
-    Value getStack(uint8_t index);
-    void setStack(uint8_t index, Value value);
     Obj* getObjects();
+    ObjPool& getPool();     //各尺寸级别的分配计数见ObjPool::classStats
+    void setOutput(std::ostream& out, std::ostream& err);
+    std::ostream& out();
+    std::ostream& err();
     InterpretResult interpret(const std::string& source);
-};
+    InterpretResult interpret(const char* source, size_t length);   //source[length]必须是'\0'
+    bool compile(const char* source, size_t length, Chunk* chunk);  //只编译，字符串常量驻留在本VM
+    //执行已编译的chunk，冻结的chunk可以在多个VM间共享。
+    //最多执行budget条指令，用完返回INTERPRET_YIELD，暂停期间chunk必须保持有效
+    InterpretResult interpret(const Chunk& chunk, uint64_t budget = BUDGET_UNLIMITED);
+    InterpretResult resume(uint64_t budget = BUDGET_UNLIMITED);    //从暂停处继续，没有暂停的脚本时返回INTERPRET_OK
+    bool isSuspended() const { return m_chunk != nullptr; }
+
+    //嵌入接口：编译一次得到Script，之后在任意VM上反复执行
+    InterpretResult compile(const std::string& source, Script* script);
+    InterpretResult execute(const Script& script, uint64_t budget = BUDGET_UNLIMITED);
+    void setGlobal(const std::string& name, Value value);  //注入全局变量，脚本里直接按名字读
+    bool getGlobal(const std::string& name, Value* value);
+    Value newString(const std::string& s);     //在本VM的堆上创建(驻留)字符串
+    //注册原生函数，作为全局变量对脚本可见。arity为-1表示实参个数不定
+    void defineNative(const std::string& name, int arity, NativeFn function);
+    void defineNative(const std::string& name, NativeNumber1 function);
+    void defineNative(const std::string& name, NativeNumber2 function);
+
+    //堆快照，格式见snapshot.h。保存全局变量能到达的所有对象，能到达打开的文件时失败。
+    //加载把快照里的全局变量加到本VM上，函数的字节码重新验证，失败时报告到err()，全局变量不变
+    bool saveSnapshot(const std::string& path);
+    bool loadSnapshot(const std::string& path);
 
-extern class VM vm;
\ No newline at end of file
+    VMStats getStats();
+    void setName(const std::string& name);     //用在分析结果里，默认是"script"
+    void takeSample();      //由SIGPROF处理函数调用
+    void setDumpOnError(bool dump);
+    void dumpFlightRecorder(std::ostream& out);    //解码输出最近执行的指令，只在运行中或暂停时有效
+    void countAllocation(ObjType type, size_t bytes){
+        m_stats.objects[type]++;
+        m_stats.objectBytes[type] += bytes;
+    }
+};
\ No newline at end of file
@@ -0,0 +1,275 @@
+#include <assert.h>
+#include <vector>
+#include <unordered_map>
+#include "infer.h"
+#include "object.h"
+
+//每个栈槽位一个字节，1表示一定是数字，下标是相对帧槽位0的位置
+typedef std::vector<uint8_t> SlotTypes;
+
+//按基本块做数据流：只在块入口保存类型，块内顺序推算。
+//入口类型第一次到达时追加进同一个数组，不为每个块单独分配
+typedef struct{
+    Chunk* chunk;
+    const uint8_t* code;
+    std::vector<bool> isStart;      //这个偏移是不是块开头
+    std::unordered_map<int, int> blockAt;   //块开头的偏移对应的块下标
+    std::vector<int> starts;        //每个块开头的偏移
+    std::vector<int> entryAt;       //每个块入口类型在entries里的位置，-1表示还没有到达
+    std::vector<int> entrySize;
+    SlotTypes entries;
+    SlotTypes types;                //正在推算的块，反复复用
+    std::vector<int> worklist;
+} Inference;
+
+static void addBlock(Inference* inference, int offset){
+    if(inference->isStart[offset]) return;
+    inference->isStart[offset] = true;
+    inference->blockAt.emplace(offset, (int)inference->starts.size());
+    inference->starts.push_back(offset);
+}
+
+//类型流进块入口，第一次到达或入口类型变少时重新推算这个块
+static void flow(Inference* inference, int offset, const SlotTypes& types){
+    int block = inference->blockAt.find(offset)->second;
+    if(inference->entryAt[block] < 0){
+        inference->entryAt[block] = (int)inference->entries.size();
+        inference->entrySize[block] = (int)types.size();
+        inference->entries.insert(inference->entries.end(), types.begin(), types.end());
+        inference->worklist.push_back(block);
+        return;
+    }
+    assert(inference->entrySize[block] == (int)types.size());     //验证器保证汇合处深度相同
+    uint8_t* entry = inference->entries.data() + inference->entryAt[block];
+    bool changed = false;
+    for(size_t i = 0; i < types.size(); i++){
+        if(entry[i] && !types[i]){
+            entry[i] = 0;
+            changed = true;
+        }
+    }
+    if(changed) inference->worklist.push_back(block);
+}
+
+static void pop(SlotTypes* types, int count){
+    types->resize(types->size() - count);
+}
+
+static void popPush(SlotTypes* types, int count, uint8_t number){
+    pop(types, count);
+    types->push_back(number);
+}
+
+//按指令推算执行后的类型。检查过类型的指令执行成功时，结果和被检查的槽位就一定是数字。
+//返回false表示不会顺序执行到下一条
+static bool step(Inference* inference, int offset, SlotTypes* types){
+    const uint8_t* code = inference->code;
+    Chunk* chunk = inference->chunk;
+    size_t top = types->size() - 1;
+    switch(code[offset]){
+        case OP_CONSTANT:
+            types->push_back(IS_NUMBER(chunk->getConstant(code[offset + 1])));
+            break;
+        case OP_CONSTANT_LONG:
+            types->push_back(IS_NUMBER(chunk->getConstant(chunk->getLong(offset + 1))));
+            break;
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+            types->push_back(0);
+            break;
+        case OP_GET_LOCAL:
+            types->push_back((*types)[code[offset + 1]]);
+            break;
+        case OP_SET_LOCAL:
+            (*types)[code[offset + 1]] = (*types)[top];
+            break;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_PRINT:
+            pop(types, 1);
+            break;
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_LONG:
+            break;
+        case OP_NOT:
+            (*types)[top] = 0;
+            break;
+        case OP_NEGATE:
+        case OP_NEGATE_NUM:
+            (*types)[top] = 1;
+            break;
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GREATER_NUM:
+        case OP_LESS_NUM:
+        case OP_GET_INDEX:
+        case OP_IN:
+            popPush(types, 2, 0);
+            break;
+        case OP_ADD:
+        case OP_ADD_NUM: {
+            //两个字符串相加是拼接
+            uint8_t number = (*types)[top] & (*types)[top - 1];
+            popPush(types, 2, number);
+            break;
+        }
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_SUBTRACT_NUM:
+        case OP_MULTIPLY_NUM:
+        case OP_DIVIDE_NUM:
+            popPush(types, 2, 1);
+            break;
+        case OP_SET_INDEX: {
+            uint8_t value = (*types)[top];
+            popPush(types, 3, value);
+            break;
+        }
+        case OP_DELETE:
+            pop(types, 2);
+            break;
+        case OP_CALL:
+            popPush(types, code[offset + 1] + 1, 0);
+            break;
+        case OP_MAP:
+            popPush(types, 2 * code[offset + 1], 0);
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            flow(inference, branchTarget(code, offset), *types);
+            return false;
+        case OP_JUMP_IF_FALSE:
+            flow(inference, branchTarget(code, offset), *types);
+            break;
+        case OP_FOR_TEST:
+            //循环变量和上界在比较前检查过，跳出循环时也一样
+            (*types)[code[offset + 1]] = 1;
+            if(code[offset + 2] & FOR_LIMIT_LOCAL) (*types)[code[offset + 3]] = 1;
+            flow(inference, branchTarget(code, offset), *types);
+            break;
+        case OP_FOR_STEP:
+            (*types)[code[offset + 1]] = 1;
+            flow(inference, branchTarget(code, offset), *types);
+            return false;
+        case OP_JUMP_TABLE:
+        case OP_CASE_TABLE:
+            pop(types, 1);
+            for(int entry = 0; entry <= switchCount(code, offset); entry++){
+                flow(inference, switchTarget(code, offset, entry), *types);
+            }
+            return false;
+        case OP_RETURN:
+            return false;
+    }
+    return true;
+}
+
+static uint8_t checkedForm(uint8_t instruction){
+    switch(instruction){
+        case OP_GREATER_NUM:  return OP_GREATER;
+        case OP_LESS_NUM:     return OP_LESS;
+        case OP_ADD_NUM:      return OP_ADD;
+        case OP_SUBTRACT_NUM: return OP_SUBTRACT;
+        case OP_MULTIPLY_NUM: return OP_MULTIPLY;
+        case OP_DIVIDE_NUM:   return OP_DIVIDE;
+        case OP_NEGATE_NUM:   return OP_NEGATE;
+        default:              return instruction;
+    }
+}
+
+static uint8_t numberForm(uint8_t instruction){
+    switch(instruction){
+        case OP_GREATER:  return OP_GREATER_NUM;
+        case OP_LESS:     return OP_LESS_NUM;
+        case OP_ADD:      return OP_ADD_NUM;
+        case OP_SUBTRACT: return OP_SUBTRACT_NUM;
+        case OP_MULTIPLY: return OP_MULTIPLY_NUM;
+        case OP_DIVIDE:   return OP_DIVIDE_NUM;
+        case OP_NEGATE:   return OP_NEGATE_NUM;
+        default:          return instruction;
+    }
+}
+
+//从块入口顺序推算到块结束，同时按推算出的类型选择操作码。
+//入口类型只会变少，变少时整块重新推算，所以每块最后一次推算的选择就是最终结果
+static void walkBlock(Inference* inference, int block){
+    SlotTypes& types = inference->types;
+    const uint8_t* entry = inference->entries.data() + inference->entryAt[block];
+    types.assign(entry, entry + inference->entrySize[block]);
+    int offset = inference->starts[block];
+    for(;;){
+        uint8_t instruction = inference->code[offset];
+        uint8_t checked = checkedForm(instruction);
+        uint8_t specialized = numberForm(checked);
+        if(specialized != checked){
+            size_t depth = types.size();
+            bool proven = checked == OP_NEGATE ? types[depth - 1] : types[depth - 1] && types[depth - 2];
+            uint8_t chosen = proven ? specialized : checked;
+            if(chosen != instruction) inference->chunk->changeCode(offset, chosen);
+        }
+        if(!step(inference, offset, &types)) return;
+        offset += instructionSize(inference->code, offset);
+        if(inference->isStart[offset]){
+            flow(inference, offset, types);
+            return;
+        }
+    }
+}
+
+static void specializeCode(Chunk* chunk, int entryDepth){
+    Inference inference;
+    int count = chunk->getCount();
+    inference.chunk = chunk;
+    inference.code = chunk->getFirstCode();
+    inference.isStart.assign(count, false);
+
+    //块开头：入口和所有跳转目标
+    addBlock(&inference, 0);
+    for(int offset = 0; offset < count; offset += instructionSize(inference.code, offset)){
+        if(isBranch(inference.code[offset])) addBlock(&inference, branchTarget(inference.code, offset));
+        if(isSwitch(inference.code[offset])){
+            for(int entry = 0; entry <= switchCount(inference.code, offset); entry++){
+                addBlock(&inference, switchTarget(inference.code, offset, entry));
+            }
+        }
+    }
+    inference.entryAt.assign(inference.starts.size(), -1);
+    inference.entrySize.assign(inference.starts.size(), 0);
+
+    //槽位的类型只会从数字变成未知，迭代次数有上限。到达不了的块不动
+    int maxStack = chunk->getMaxStack();
+    flow(&inference, 0, SlotTypes(entryDepth, 0));
+    while(!inference.worklist.empty()){
+        int block = inference.worklist.back();
+        inference.worklist.pop_back();
+        walkBlock(&inference, block);
+    }
+    chunk->setMaxStack(maxStack);
+}
+
+//函数各自推断，进入时参数的类型未知
+static void specializeTree(Chunk* chunk, int entryDepth){
+    specializeCode(chunk, entryDepth);
+    for(int i = 0; i < chunk->getConstantCount(); i++){
+        Value constant = chunk->getConstant(i);
+        if(!IS_OBJ(constant) || !IS_FUNCTION(constant)) continue;
+        ObjFunction* function = AS_FUNCTION(constant);
+        specializeTree(&function->m_chunk, function->m_arity + 1);
+    }
+}
+
+void specializeNumbers(Chunk* chunk){
+    assert(chunk->isVerified());
+    specializeTree(chunk, 0);
+}
+
+void specializeFunction(ObjFunction* function){
+    assert(function->m_chunk.isVerified());
+    specializeCode(&function->m_chunk, function->m_arity + 1);
+}
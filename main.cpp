@@ -1,16 +1,42 @@
 #include <stdio.h>
 #include <string.h>
-#include <fstream>
 #include <stdlib.h>
-#include "common.h" 
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include "common.h"
 #include "chunk.h"
 #include "debug.h"
 #include "vm.h"
 #include "compiler.h"
+#include "source.h"
+#include "aot.h"
+
+//命令行选项，对所有运行模式生效
+typedef struct{
+    bool stats;     //--stats / --stats=json：退出前把VM的运行计数以JSON写到stderr
+    bool flightRecorder;    //--flight-recorder：运行时错误时输出最近执行的指令
+    const char* profile;    //--profile=path：采样分析，退出前把折叠栈写到path
+    const char* snapshot;   //--snapshot=path：运行脚本前从快照恢复全局变量
+    const char* saveSnapshot;   //--save-snapshot=path：单个脚本正常结束后把堆保存成快照
+} Options;
 
-VM vm;
+static Options options = {false, false, nullptr, nullptr, nullptr};
+
+//把命令行选项应用到新建的VM上，快照加载失败时返回false
+static bool configure(VM& vm){
+    vm.setDumpOnError(options.flightRecorder);
+    return options.snapshot == nullptr || vm.loadSnapshot(options.snapshot);
+}
 
 static void repl(){
+    VM vm;
+    if(!configure(vm)) return;
     char line[1024];
     for(;;){
         std::cout<<"> ";
@@ -20,48 +46,243 @@ static void repl(){
             break;
         }
         vm.interpret(line);
-        
+
     }
 }
 
-static std::string readFile(const std::string& path){
-    std::ifstream file;
-    file.open(path, std::ios::in | std::ios::binary);
-    if(!file.is_open()){
-        std::cerr<<"could not open file "<< path<< std::endl;
-        exit(74);
+static int exitCode(InterpretResult result){
+    if(result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
+
+//在给定的VM上运行一个脚本文件，返回进程退出码
+static int runScript(VM& vm, const std::string& path){
+    if(!configure(vm)) return 74;
+    vm.setName(path);
+    vm.out()<<path<<std::endl;
+    SourceFile source;
+    if(!source.open(path)){
+        vm.err()<<"could not open file "<< path<< std::endl;
+        return 74;
+    }
+    InterpretResult result = vm.interpret(source.data(), source.size());
+    if(options.stats) printStatsJson(vm.getStats(), vm.err());
+    return exitCode(result);
+}
+
+static int runFile(const std::string& path){
+    VM vm;
+    int status = runScript(vm, path);
+    if(status == 0 && options.saveSnapshot != nullptr && !vm.saveSnapshot(options.saveSnapshot)) status = 74;
+    return status;
+}
+
+//批量运行：每个文件一个独立的VM，输出先写进各自的缓冲区，
+//主线程按命令行顺序依次输出，保证每个文件的输出不交错
+typedef struct{
+    std::ostringstream out;
+    std::ostringstream err;
+    int exitCode = 0;
+    bool done = false;
+} BatchResult;
+
+static int runBatch(const std::vector<std::string>& paths, int jobs){
+    std::vector<BatchResult> results(paths.size());
+    std::atomic<size_t> next(0);
+    std::mutex lock;
+    std::condition_variable finished;
+
+    auto worker = [&](){
+        for(;;){
+            size_t i = next++;
+            if(i >= paths.size()) return;
+            BatchResult& result = results[i];
+            int code;
+            {
+                VM vm;
+                vm.setOutput(result.out, result.err);
+                code = runScript(vm, paths[i]);
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            result.exitCode = code;
+            result.done = true;
+            finished.notify_all();
+        }
+    };
+
+    if(jobs > (int)paths.size()) jobs = (int)paths.size();
+    std::vector<std::thread> pool;
+    for(int i = 0; i < jobs; i++) pool.emplace_back(worker);
+
+    int status = 0;
+    for(size_t i = 0; i < paths.size(); i++){
+        BatchResult& result = results[i];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&](){ return result.done; });
+        }
+        std::cout<<result.out.str();
+        std::cerr<<result.err.str();
+        std::cerr<<paths[i]<<": exit "<<result.exitCode<<std::endl;
+        if(status == 0) status = result.exitCode;
+    }
+
+    for(std::thread& t : pool) t.join();
+    return status;
+}
+
+//单线程轮转：每个文件一个VM，每个脚本每轮最多执行slice条指令就换下一个，
+//死循环的脚本只占自己的时间片，不会卡住其他脚本。输出同样按命令行顺序
+typedef struct{
+    VM vm;
+    Chunk chunk;
+    BatchResult result;
+} Task;
+
+static int runInterleaved(const std::vector<std::string>& paths, uint64_t slice){
+    std::vector<std::unique_ptr<Task>> tasks;
+    std::vector<Task*> running;
+    for(const std::string& path : paths){
+        tasks.emplace_back(new Task());
+        Task* task = tasks.back().get();
+        task->vm.setOutput(task->result.out, task->result.err);
+        task->vm.setName(path);
+        task->vm.out()<<path<<std::endl;
+
+        SourceFile source;
+        if(!configure(task->vm)){
+            task->result.exitCode = 74;
+        }else if(!source.open(path)){
+            task->vm.err()<<"could not open file "<< path<< std::endl;
+            task->result.exitCode = 74;
+        }else if(!task->vm.compile(source.data(), source.size(), &task->chunk)){
+            task->result.exitCode = 65;
+        }else{
+            running.push_back(task);
+        }
     }
 
-    file.seekg(0, std::ios::end);
-    std::streamsize fileSize = file.tellg();
-    file.seekg(0, std::ios::beg);
+    bool first = true;
+    while(!running.empty()){
+        std::vector<Task*> next;
+        for(Task* task : running){
+            InterpretResult result = first ? task->vm.interpret(task->chunk, slice)
+                                           : task->vm.resume(slice);
+            if(result == INTERPRET_YIELD){
+                next.push_back(task);
+                continue;
+            }
+            if(options.stats) printStatsJson(task->vm.getStats(), task->vm.err());
+            task->result.exitCode = exitCode(result);
+        }
+        running.swap(next);
+        first = false;
+    }
 
-    std::string buffer(fileSize+1, '\0');
-    
-    file.read(&buffer[0],fileSize);
-    file.close();
-    return buffer;
+    int status = 0;
+    for(size_t i = 0; i < paths.size(); i++){
+        BatchResult& result = tasks[i]->result;
+        std::cout<<result.out.str();
+        std::cerr<<result.err.str();
+        std::cerr<<paths[i]<<": exit "<<result.exitCode<<std::endl;
+        if(status == 0) status = result.exitCode;
+    }
+    return status;
 }
 
-static void runFile(const std::string& path){
-    std::cout<<path<<std::endl;
-    std::string source = readFile(path);
-    InterpretResult result = vm.interpret(source);
+//把脚本编译成C++源码，用法见makefile的aot目标
+static int emitFile(const std::string& path, const std::string& outPath){
+    VM vm;
+    SourceFile source;
+    if(!source.open(path)){
+        std::cerr<<"could not open file "<< path<< std::endl;
+        return 74;
+    }
+    Chunk chunk;
+    if(!vm.compile(source.data(), source.size(), &chunk)) return 65;
+
+    std::ofstream out(outPath);
+    if(!out.is_open()){
+        std::cerr<<"could not open file "<< outPath<< std::endl;
+        return 74;
+    }
+    if(!emitCpp(chunk, path.c_str(), out)) return 65;
+    return 0;
+}
 
-    if(result == INTERPRET_COMPILE_ERROR) exit(65);
-    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+static void usage(){
+    fprintf(stderr, "Usage: cpplox [options] [path]\n"
+                    "       cpplox [options] --jobs N path...\n"
+                    "       cpplox [options] --slice N path...\n"
+                    "       cpplox --emit-cpp path out.cpp\n"
+                    "Options:\n"
+                    "  --stats[=json]      print run counters as JSON to stderr\n"
+                    "  --flight-recorder   on a runtime error, print the last executed instructions\n"
+                    "  --profile=path      sample with SIGPROF and write collapsed stacks to path\n"
+                    "  --snapshot=path     restore the globals from a heap snapshot before running\n"
+                    "  --save-snapshot=path\n"
+                    "                      after a single script succeeds, save its heap as a snapshot\n"
+                    "--emit-cpp only handles scripts without function declarations ('fun').\n");
+    exit(64);
 }
 
 int main(int argc, char* argv[]){
-    argc = 2;
-    argv[1] = "test.txt";
-    if(argc == 1){
+    int arg = 1;
+    for(; arg < argc; arg++){
+        if(strcmp(argv[arg], "--stats") == 0 || strcmp(argv[arg], "--stats=json") == 0){
+            options.stats = true;
+        }else if(strcmp(argv[arg], "--flight-recorder") == 0){
+            options.flightRecorder = true;
+        }else if(strncmp(argv[arg], "--profile=", 10) == 0 && argv[arg][10] != '\0'){
+            options.profile = argv[arg] + 10;
+        }else if(strncmp(argv[arg], "--snapshot=", 11) == 0 && argv[arg][11] != '\0'){
+            options.snapshot = argv[arg] + 11;
+        }else if(strncmp(argv[arg], "--save-snapshot=", 16) == 0 && argv[arg][16] != '\0'){
+            options.saveSnapshot = argv[arg] + 16;
+        }else{
+            break;
+        }
+    }
+
+    if(options.profile != nullptr && !startProfiler()){
+        fprintf(stderr, "could not start profiler\n");
+        return 70;
+    }
+
+    int status = 0;
+    int rest = argc - arg;
+    //快照只从一个脚本的堆保存
+    if(options.saveSnapshot != nullptr && rest != 1) usage();
+    if(rest == 0){
         repl();
-    }else if(argc == 2){
-        runFile(argv[1]);
+    }else if(strcmp(argv[arg], "--jobs") == 0){
+        if(rest < 3) usage();
+        int jobs = atoi(argv[arg + 1]);
+        if(jobs < 1) usage();
+        std::vector<std::string> paths(argv + arg + 2, argv + argc);
+        status = runBatch(paths, jobs);
+    }else if(strcmp(argv[arg], "--slice") == 0){
+        if(rest < 3) usage();
+        long long slice = atoll(argv[arg + 1]);
+        if(slice < 1) usage();
+        std::vector<std::string> paths(argv + arg + 2, argv + argc);
+        status = runInterleaved(paths, (uint64_t)slice);
+    }else if(strcmp(argv[arg], "--emit-cpp") == 0){
+        if(rest != 3) usage();
+        status = emitFile(argv[arg + 1], argv[arg + 2]);
+    }else if(rest == 1){
+        status = runFile(argv[arg]);
     }else{
-        fprintf(stderr, "Usage: cpplox [path]\n");
-        exit(64);
+        usage();
     }
-    return 0;
-}
\ No newline at end of file
+
+    if(options.profile != nullptr){
+        stopProfiler();
+        if(!writeProfile(options.profile)){
+            std::cerr<<"could not open file "<< options.profile<< std::endl;
+            if(status == 0) status = 74;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,87 @@
+#include <assert.h>
+#include <new>
+#include "memory.h"
+
+static const size_t slotSizes[POOL_CLASS_COUNT] = {32, 64, 128, 256};
+
+ObjPool::ObjPool(){
+    for(int i = 0; i < POOL_CLASS_COUNT; i++){
+        SizeClass& sc = m_classes[i];
+        sc.freeList = nullptr;
+        sc.bump = nullptr;
+        sc.bumpEnd = nullptr;
+        sc.stats = PoolStats{slotSizes[i], 0, 0, 0, 0};
+    }
+}
+
+ObjPool::~ObjPool(){
+    releaseAll();
+}
+
+int ObjPool::classIndex(size_t size){
+    for(int i = 0; i < POOL_CLASS_COUNT; i++){
+        if(size <= slotSizes[i]) return i;
+    }
+    return -1;
+}
+
+void* ObjPool::allocate(size_t size){
+    int index = classIndex(size);
+    assert(index >= 0);
+
+    SizeClass& sc = m_classes[index];
+    sc.stats.allocations++;
+    sc.stats.live++;
+    if(sc.freeList != nullptr){
+        FreeSlot* slot = sc.freeList;
+        sc.freeList = slot->next;
+        return slot;
+    }
+    //没有slab时bump和bumpEnd都是空指针，比较剩余字节数，不对空指针做加法
+    if((size_t)(sc.bumpEnd - sc.bump) < sc.stats.slotSize){
+        char* slab = (char*)::operator new(POOL_SLAB_SIZE);
+        sc.slabs.push_back(slab);
+        sc.stats.slabs++;
+        sc.bump = slab;
+        sc.bumpEnd = slab + POOL_SLAB_SIZE;
+    }
+    void* slot = sc.bump;
+    sc.bump += sc.stats.slotSize;
+    return slot;
+}
+
+void ObjPool::release(void* pointer, size_t size){
+    int index = classIndex(size);
+    assert(index >= 0);
+
+    SizeClass& sc = m_classes[index];
+    sc.stats.frees++;
+    sc.stats.live--;
+    FreeSlot* slot = (FreeSlot*)pointer;
+    slot->next = sc.freeList;
+    sc.freeList = slot;
+}
+
+void ObjPool::releaseAll(){
+    for(int i = 0; i < POOL_CLASS_COUNT; i++){
+        SizeClass& sc = m_classes[i];
+        for(char* slab : sc.slabs){
+            ::operator delete(slab);
+        }
+        sc.slabs.clear();
+        sc.freeList = nullptr;
+        sc.bump = nullptr;
+        sc.bumpEnd = nullptr;
+        sc.stats.frees += sc.stats.live;
+        sc.stats.live = 0;
+    }
+}
+
+int ObjPool::classCount() const{
+    return POOL_CLASS_COUNT;
+}
+
+const PoolStats& ObjPool::classStats(int index) const{
+    return m_classes[index].stats;
+}
+
@@ -0,0 +1,437 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <sstream>
+#include "natives.h"
+#include "arrays.h"
+#include "text.h"
+#include "vm.h"
+
+bool nativeError(VM* vm, Value* result, const char* format, ...){
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    *result = vm->newString(message);
+    return false;
+}
+
+//数字实参必须是整数时用，比如下标和长度
+static bool integerArg(Value value, int* out){
+    if(!IS_NUMBER(value)) return false;
+    double number = AS_NUMBER(value);
+    if(number != floor(number) || number < INT32_MIN || number > INT32_MAX) return false;
+    *out = (int)number;
+    return true;
+}
+
+static bool clockNative(VM* vm, int argCount, Value* args, Value* result){
+    *result = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+    return true;
+}
+
+static bool lenNative(VM* vm, int argCount, Value* args, Value* result){
+    if(IS_OBJ(args[0]) && IS_ARRAY(args[0])){
+        *result = INT_VAL((int32_t)AS_ARRAY(args[0])->m_values.size());
+        return true;
+    }
+    if(IS_OBJ(args[0]) && IS_MAP(args[0])){
+        *result = INT_VAL((int32_t)AS_MAP(args[0])->m_count);
+        return true;
+    }
+    if(!IS_OBJ(args[0]) || !IS_STRING(args[0])){
+        return nativeError(vm, result, "Argument to 'len' must be a string, an array or a map.");
+    }
+    *result = INT_VAL((int32_t)AS_CSTRING(args[0]).size());
+    return true;
+}
+
+//str(value)：和print输出的文本一样。readLine返回的行在这里复制一份，要留着的行先过一遍str
+static bool strNative(VM* vm, int argCount, Value* args, Value* result){
+    if(IS_OBJ(args[0]) && IS_STRING(args[0])){
+        *result = keepString(vm, args[0]);
+        return true;
+    }
+    std::ostringstream out;
+    printValue(args[0], out);
+    *result = vm->newString(out.str());
+    return true;
+}
+
+//num(string)：整个字符串是一个数字时返回它，否则返回nil
+static bool numNative(VM* vm, int argCount, Value* args, Value* result){
+    if(IS_NUMBER(args[0])){
+        *result = args[0];
+        return true;
+    }
+    if(!IS_OBJ(args[0]) || !IS_STRING(args[0])){
+        return nativeError(vm, result, "Argument to 'num' must be a string or a number.");
+    }
+    std::string s(AS_CSTRING(args[0]));  //strtod要以\0结尾
+    char* end;
+    double number = strtod(s.c_str(), &end);
+    *result = (s.empty() || isspace((unsigned char)s[0]) || *end != '\0') ? NIL_VAL : NUMBER_VAL(number);
+    return true;
+}
+
+//substr(string, start, length)：越界的部分截掉。结果不驻留，用作散列表的键时才算散列值
+static bool substrNative(VM* vm, int argCount, Value* args, Value* result){
+    int start, length;
+    if(!IS_OBJ(args[0]) || !IS_STRING(args[0]) || !integerArg(args[1], &start) || !integerArg(args[2], &length)){
+        return nativeError(vm, result, "Arguments to 'substr' must be a string and two integers.");
+    }
+    std::string_view s = AS_CSTRING(args[0]);
+    int size = (int)s.size();
+    if(start < 0) start = 0;
+    if(start > size) start = size;
+    if(length < 0) length = 0;
+    if(length > size - start) length = size - start;
+    *result = OBJ_VAL(allocateString(vm, s.data() + start, length));
+    return true;
+}
+
+static bool changeCase(VM* vm, Value* args, Value* result, void (*convert)(char*, size_t), const char* name){
+    if(!IS_OBJ(args[0]) || !IS_STRING(args[0])){
+        return nativeError(vm, result, "Argument to '%s' must be a string.", name);
+    }
+    std::string s(AS_CSTRING(args[0]));
+    int length = (int)s.size();
+    convert(&s[0], length);
+    *result = OBJ_VAL(makeString(vm, std::move(s), length));
+    return true;
+}
+
+static bool upperNative(VM* vm, int argCount, Value* args, Value* result){
+    return changeCase(vm, args, result, upperText, "upper");
+}
+
+static bool lowerNative(VM* vm, int argCount, Value* args, Value* result){
+    return changeCase(vm, args, result, lowerText, "lower");
+}
+
+//实参都必须是字符串
+static bool stringArgs(VM* vm, int argCount, Value* args, Value* result, const char* name){
+    for(int i = 0; i < argCount; i++){
+        if(!IS_OBJ(args[i]) || !IS_STRING(args[i])){
+            return nativeError(vm, result, "Arguments to '%s' must be strings.", name);
+        }
+    }
+    return true;
+}
+
+//indexOf(string, needle)：第一次出现的下标，没有时返回-1
+static bool indexOfNative(VM* vm, int argCount, Value* args, Value* result){
+    if(!stringArgs(vm, argCount, args, result, "indexOf")) return false;
+    std::string_view s = AS_CSTRING(args[0]);
+    std::string_view needle = AS_CSTRING(args[1]);
+    const char* found = findText(s.data(), s.size(), needle.data(), needle.size());
+    *result = INT_VAL(found == nullptr ? -1 : (int32_t)(found - s.data()));
+    return true;
+}
+
+static bool containsNative(VM* vm, int argCount, Value* args, Value* result){
+    if(!stringArgs(vm, argCount, args, result, "contains")) return false;
+    std::string_view s = AS_CSTRING(args[0]);
+    std::string_view needle = AS_CSTRING(args[1]);
+    *result = BOOL_VAL(findText(s.data(), s.size(), needle.data(), needle.size()) != nullptr);
+    return true;
+}
+
+static bool startsWithNative(VM* vm, int argCount, Value* args, Value* result){
+    if(!stringArgs(vm, argCount, args, result, "startsWith")) return false;
+    std::string_view s = AS_CSTRING(args[0]);
+    std::string_view prefix = AS_CSTRING(args[1]);
+    *result = BOOL_VAL(prefix.size() <= s.size() && memcmp(s.data(), prefix.data(), prefix.size()) == 0);
+    return true;
+}
+
+static bool endsWithNative(VM* vm, int argCount, Value* args, Value* result){
+    if(!stringArgs(vm, argCount, args, result, "endsWith")) return false;
+    std::string_view s = AS_CSTRING(args[0]);
+    std::string_view suffix = AS_CSTRING(args[1]);
+    *result = BOOL_VAL(suffix.size() <= s.size() &&
+                       memcmp(s.data() + s.size() - suffix.size(), suffix.data(), suffix.size()) == 0);
+    return true;
+}
+
+//compare(a, b)：按字节比较，返回-1、0或1
+static bool compareNative(VM* vm, int argCount, Value* args, Value* result){
+    if(!stringArgs(vm, argCount, args, result, "compare")) return false;
+    int order = AS_CSTRING(args[0]).compare(AS_CSTRING(args[1]));
+    *result = INT_VAL(order < 0 ? -1 : order > 0 ? 1 : 0);
+    return true;
+}
+
+//split(string, separator)：返回下标0..n-1到各段的散列表，用len()取段数。
+//各段直接从原字符串的字符复制，不驻留，用作散列表的键时才算散列值
+static bool splitNative(VM* vm, int argCount, Value* args, Value* result){
+    if(!stringArgs(vm, argCount, args, result, "split")) return false;
+    std::string_view s = AS_CSTRING(args[0]);
+    std::string_view separator = AS_CSTRING(args[1]);
+    if(separator.empty()) return nativeError(vm, result, "Separator passed to 'split' must not be empty.");
+
+    ObjMap* pieces = (ObjMap*)allocateObj(vm, OBJ_MAP);
+    const char* start = s.data();
+    const char* end = s.data() + s.size();
+    int32_t count = 0;
+    for(;;){
+        const char* found = findText(start, end - start, separator.data(), separator.size());
+        const char* stop = found == nullptr ? end : found;
+        pieces->set(INT_VAL(count++), OBJ_VAL(allocateString(vm, start, (int)(stop - start))));
+        if(found == nullptr) break;
+        start = found + separator.size();
+    }
+    *result = OBJ_VAL(pieces);
+    return true;
+}
+
+//replace(string, from, to)：替换所有不重叠的出现
+static bool replaceNative(VM* vm, int argCount, Value* args, Value* result){
+    if(!stringArgs(vm, argCount, args, result, "replace")) return false;
+    std::string_view s = AS_CSTRING(args[0]);
+    std::string_view from = AS_CSTRING(args[1]);
+    std::string_view to = AS_CSTRING(args[2]);
+    if(from.empty()) return nativeError(vm, result, "Pattern passed to 'replace' must not be empty.");
+
+    const char* start = s.data();
+    const char* end = s.data() + s.size();
+    const char* found = findText(start, end - start, from.data(), from.size());
+    if(found == nullptr){
+        *result = args[0];
+        return true;
+    }
+    std::string replaced;
+    replaced.reserve(s.size());
+    while(found != nullptr){
+        replaced.append(start, found);
+        replaced += to;
+        start = found + from.size();
+        found = findText(start, end - start, from.data(), from.size());
+    }
+    replaced.append(start, end);
+    int length = (int)replaced.size();
+    *result = OBJ_VAL(makeString(vm, std::move(replaced), length));
+    return true;
+}
+
+//array(n)：n个0组成的数组
+static bool arrayNative(VM* vm, int argCount, Value* args, Value* result){
+    int length;
+    if(!integerArg(args[0], &length) || length < 0 || length > ARRAY_MAX){
+        return nativeError(vm, result, "Array length must be an integer between 0 and %d.", ARRAY_MAX);
+    }
+    ObjArray* array = (ObjArray*)allocateObj(vm, OBJ_ARRAY);
+    array->m_values.assign(length, 0.0);
+    vm->countAllocation(OBJ_ARRAY, length * sizeof(double));
+    *result = OBJ_VAL(array);
+    return true;
+}
+
+static bool arrayArg(VM* vm, Value value, Value* result, const char* name, ObjArray** array){
+    if(!IS_OBJ(value) || !IS_ARRAY(value)){
+        return nativeError(vm, result, "Argument to '%s' must be an array.", name);
+    }
+    *array = AS_ARRAY(value);
+    return true;
+}
+
+//两个数组参数，长度必须相同
+static bool arrayPair(VM* vm, Value* args, Value* result, const char* name, ObjArray** a, ObjArray** b){
+    if(!arrayArg(vm, args[0], result, name, a) || !arrayArg(vm, args[1], result, name, b)) return false;
+    if((*a)->m_values.size() != (*b)->m_values.size()){
+        return nativeError(vm, result, "Arrays passed to '%s' must have the same length.", name);
+    }
+    return true;
+}
+
+static bool sumNative(VM* vm, int argCount, Value* args, Value* result){
+    ObjArray* a = nullptr;
+    if(!arrayArg(vm, args[0], result, "sum", &a)) return false;
+    *result = NUMBER_VAL(arraySum(a->m_values.data(), a->m_values.size()));
+    return true;
+}
+
+//amin/amax：空数组没有最小值、最大值
+static bool extremeNative(VM* vm, Value* args, Value* result, const char* name,
+                          double (*kernel)(const double*, size_t)){
+    ObjArray* a = nullptr;
+    if(!arrayArg(vm, args[0], result, name, &a)) return false;
+    if(a->m_values.empty()) return nativeError(vm, result, "Array passed to '%s' is empty.", name);
+    *result = NUMBER_VAL(kernel(a->m_values.data(), a->m_values.size()));
+    return true;
+}
+
+static bool aminNative(VM* vm, int argCount, Value* args, Value* result){
+    return extremeNative(vm, args, result, "amin", arrayMin);
+}
+
+static bool amaxNative(VM* vm, int argCount, Value* args, Value* result){
+    return extremeNative(vm, args, result, "amax", arrayMax);
+}
+
+static bool dotNative(VM* vm, int argCount, Value* args, Value* result){
+    ObjArray *a = nullptr, *b = nullptr;
+    if(!arrayPair(vm, args, result, "dot", &a, &b)) return false;
+    *result = NUMBER_VAL(arrayDot(a->m_values.data(), b->m_values.data(), a->m_values.size()));
+    return true;
+}
+
+//以下几个原地修改第一个数组，并把它返回
+static bool scaleNative(VM* vm, int argCount, Value* args, Value* result){
+    ObjArray* a = nullptr;
+    if(!arrayArg(vm, args[0], result, "scale", &a)) return false;
+    if(!IS_NUMBER(args[1])) return nativeError(vm, result, "Scale factor must be a number.");
+    arrayScale(a->m_values.data(), a->m_values.size(), AS_NUMBER(args[1]));
+    *result = args[0];
+    return true;
+}
+
+static bool vaddNative(VM* vm, int argCount, Value* args, Value* result){
+    ObjArray *a = nullptr, *b = nullptr;
+    if(!arrayPair(vm, args, result, "vadd", &a, &b)) return false;
+    arrayAdd(a->m_values.data(), b->m_values.data(), a->m_values.size());
+    *result = args[0];
+    return true;
+}
+
+static bool sortNative(VM* vm, int argCount, Value* args, Value* result){
+    ObjArray* a = nullptr;
+    if(!arrayArg(vm, args[0], result, "sort", &a)) return false;
+    arraySort(a->m_values.data(), a->m_values.size());
+    *result = args[0];
+    return true;
+}
+
+//open(path)：打开文件按行读，打不开时返回nil
+static bool openNative(VM* vm, int argCount, Value* args, Value* result){
+    if(!IS_OBJ(args[0]) || !IS_STRING(args[0])){
+        return nativeError(vm, result, "Argument to 'open' must be a string.");
+    }
+    ObjReader* reader = (ObjReader*)allocateObj(vm, OBJ_READER);
+    reader->m_path = AS_CSTRING(args[0]);
+    reader->m_open = reader->m_file.open(reader->m_path);
+    reader->m_line = allocateString(vm, "", 0);
+    *result = reader->m_open ? OBJ_VAL(reader) : NIL_VAL;
+    return true;
+}
+
+static bool readerArg(VM* vm, Value value, Value* result, const char* name, ObjReader** reader){
+    if(!IS_OBJ(value) || !IS_READER(value)){
+        return nativeError(vm, result, "Argument to '%s' must be a reader.", name);
+    }
+    *reader = AS_READER(value);
+    return true;
+}
+
+//每读过这么多字节就把读过的页还给内核
+#define READER_RELEASE_BYTES (64 << 20)
+
+//readLine(reader)：下一行，不含行尾的\n或\r\n；读完或已关闭时返回nil。
+//每次返回的都是同一个字符串对象reader->m_line，它借用映射区里的这一行，不分配也不复制，
+//读多少行都只占这一个对象。代价是上一次返回的行会跟着变：要留着的行用str()复制一份，
+//存进散列表的键和值由mapSet自动复制。
+//映射是MAP_PRIVATE的文件映射，读过的页是干净的页缓存，内存紧张时内核本来就能回收；
+//每READER_RELEASE_BYTES再madvise一次，只是让它们不再算在这个进程的RSS里。管道读进来的在堆上，不释放
+static bool readLineNative(VM* vm, int argCount, Value* args, Value* result){
+    ObjReader* reader = nullptr;
+    if(!readerArg(vm, args[0], result, "readLine", &reader)) return false;
+    const char* data = reader->m_file.data();
+    size_t size = reader->m_file.size();
+    if(!reader->m_open || reader->m_offset >= size){
+        *result = NIL_VAL;
+        return true;
+    }
+    const char* start = data + reader->m_offset;
+    const char* newline = findText(start, size - reader->m_offset, "\n", 1);
+    const char* end = newline != nullptr ? newline : data + size;
+    reader->m_offset = newline != nullptr ? (size_t)(newline + 1 - data) : size;
+
+    size_t length = end - start;
+    if(length > 0 && end[-1] == '\r' && newline != nullptr) length--;
+    if(length > INT32_MAX) return nativeError(vm, result, "Line in '%s' is too long.", reader->m_path.c_str());
+    reader->m_line->borrow(start, (int)length);
+    *result = OBJ_VAL(reader->m_line);
+
+    //当前行还要用，只释放它前面的页
+    size_t lineStart = start - data;
+    if(lineStart - reader->m_released >= READER_RELEASE_BYTES){
+        reader->m_file.release(reader->m_released, lineStart);
+        reader->m_released = lineStart;
+    }
+    return true;
+}
+
+//close(reader)：立即解除映射，之后readLine返回nil
+static bool closeNative(VM* vm, int argCount, Value* args, Value* result){
+    ObjReader* reader = nullptr;
+    if(!readerArg(vm, args[0], result, "close", &reader)) return false;
+    if(reader->m_line != nullptr) reader->m_line->borrow("", 0);   //解除映射后不能再指向映射区
+    reader->m_file.close();
+    reader->m_open = false;
+    *result = NIL_VAL;
+    return true;
+}
+
+//<math.h>里的函数有重载，取地址前先固定成double版本
+static double sqrtNative(double x){ return sqrt(x); }
+static double absNative(double x){ return fabs(x); }
+static double floorNative(double x){ return floor(x); }
+static double ceilNative(double x){ return ceil(x); }
+static double roundNative(double x){ return round(x); }
+static double sinNative(double x){ return sin(x); }
+static double cosNative(double x){ return cos(x); }
+static double tanNative(double x){ return tan(x); }
+static double expNative(double x){ return exp(x); }
+static double logNative(double x){ return log(x); }
+static double powNative(double x, double y){ return pow(x, y); }
+static double minNative(double x, double y){ return x < y ? x : y; }
+static double maxNative(double x, double y){ return x > y ? x : y; }
+
+void defineNatives(VM* vm){
+    vm->defineNative("clock", 0, clockNative);
+    vm->defineNative("len", 1, lenNative);
+    vm->defineNative("str", 1, strNative);
+    vm->defineNative("num", 1, numNative);
+    vm->defineNative("substr", 3, substrNative);
+    vm->defineNative("upper", 1, upperNative);
+    vm->defineNative("lower", 1, lowerNative);
+    vm->defineNative("indexOf", 2, indexOfNative);
+    vm->defineNative("contains", 2, containsNative);
+    vm->defineNative("startsWith", 2, startsWithNative);
+    vm->defineNative("endsWith", 2, endsWithNative);
+    vm->defineNative("compare", 2, compareNative);
+    vm->defineNative("split", 2, splitNative);
+    vm->defineNative("replace", 3, replaceNative);
+
+    vm->defineNative("open", 1, openNative);
+    vm->defineNative("readLine", 1, readLineNative);
+    vm->defineNative("close", 1, closeNative);
+
+    vm->defineNative("array", 1, arrayNative);
+    vm->defineNative("sum", 1, sumNative);
+    vm->defineNative("amin", 1, aminNative);
+    vm->defineNative("amax", 1, amaxNative);
+    vm->defineNative("dot", 2, dotNative);
+    vm->defineNative("scale", 2, scaleNative);
+    vm->defineNative("vadd", 2, vaddNative);
+    vm->defineNative("sort", 1, sortNative);
+
+    vm->defineNative("sqrt", sqrtNative);
+    vm->defineNative("abs", absNative);
+    vm->defineNative("floor", floorNative);
+    vm->defineNative("ceil", ceilNative);
+    vm->defineNative("round", roundNative);
+    vm->defineNative("sin", sinNative);
+    vm->defineNative("cos", cosNative);
+    vm->defineNative("tan", tanNative);
+    vm->defineNative("exp", expNative);
+    vm->defineNative("log", logNative);
+    vm->defineNative("pow", powNative);
+    vm->defineNative("min", minNative);
+    vm->defineNative("max", maxNative);
+}
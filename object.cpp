@@ -1,15 +1,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <new>
+#include <algorithm>
 
 #include "memory.h"
 #include "object.h"
 #include "value.h"
 #include "vm.h"
 
-#define ALLOCATE(type, count) \
-    (type*)reallocate(NULL, 0, sizeof(type) * (count))
-
 Obj::Obj(){
     m_type = OBJ;
     m_next = nullptr;
@@ -19,10 +18,23 @@ Obj::~Obj(){
     m_next = nullptr;
 }
 
+uint32_t hashString(const char* chars, size_t length){
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < length; i++){
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
 ObjString::ObjString(){
     m_length = 0;
     m_type = OBJ_STRING;
     m_string = '\0';
+    m_chars = m_string.data();
+    m_hash = 0;
+    m_hashed = false;
+    m_borrowed = false;
 }
 
 ObjString::~ObjString(){
@@ -31,74 +43,230 @@ ObjString::~ObjString(){
 
 ObjString::ObjString(const char* chars, int length){
     m_type = OBJ_STRING;
-    m_string = chars;
-    m_string+='\0';
-    m_length = length+1;
-    m_next = vm.getObjects();
+    m_string.assign(chars, length);
+    m_chars = m_string.data();
+    m_length = length;
+    m_hash = hashString(chars, length);
+    m_hashed = true;    //冻结的chunk被多个线程共享，不能之后再写
+    m_borrowed = false;
 }
 
-static void freeObject(Obj* object) {
-    switch (object->m_type) {
-        case OBJ_STRING: {
-        ObjString* string = (ObjString*)object;
-            delete string;
-        break;
-        }
+//改指别处的字符，不复制。旧的散列值作废
+void ObjString::borrow(const char* chars, int length){
+    m_chars = chars;
+    m_length = length;
+    m_hashed = false;
+    m_borrowed = true;
+}
+
+ObjNative::ObjNative(){
+    m_type = OBJ_NATIVE;
+    m_kind = NATIVE_GENERIC;
+    m_arity = 0;
+    as.function = nullptr;
+}
+
+ObjNative::~ObjNative(){
+}
+
+ObjFunction::ObjFunction(){
+    m_type = OBJ_FUNCTION;
+    m_arity = 0;
+    m_name = nullptr;
+}
+
+ObjFunction::~ObjFunction(){
+}
+
+ObjArray::ObjArray(){
+    m_type = OBJ_ARRAY;
+}
+
+ObjArray::~ObjArray(){
+}
+
+ObjReader::ObjReader(){
+    m_type = OBJ_READER;
+    m_offset = 0;
+    m_line = nullptr;
+    m_released = 0;
+    m_open = false;
+}
+
+ObjReader::~ObjReader(){
+}
+
+static_assert(sizeof(ObjString) <= POOL_MAX_SLOT && sizeof(ObjNative) <= POOL_MAX_SLOT &&
+              sizeof(ObjFunction) <= POOL_MAX_SLOT && sizeof(ObjArray) <= POOL_MAX_SLOT &&
+              sizeof(ObjMap) <= POOL_MAX_SLOT && sizeof(ObjReader) <= POOL_MAX_SLOT,
+              "every object type must fit in a pool slot");
+
+size_t objectSize(ObjType type){
+    switch (type) {
+        case OBJ_STRING: return sizeof(ObjString);
+        case OBJ_NATIVE: return sizeof(ObjNative);
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_ARRAY: return sizeof(ObjArray);
+        case OBJ_MAP: return sizeof(ObjMap);
+        case OBJ_READER: return sizeof(ObjReader);
+        default: return sizeof(Obj);
     }
 }
 
-void freeObjects() {
-    Obj* object = vm.getObjects();
+const char* objTypeName(ObjType type){
+    switch (type) {
+        case OBJ_STRING: return "string";
+        case OBJ_NATIVE: return "native";
+        case OBJ_FUNCTION: return "function";
+        case OBJ_ARRAY: return "array";
+        case OBJ_MAP: return "map";
+        case OBJ_READER: return "reader";
+        default: return "obj";
+    }
+}
+
+//单个对象：析构后把槽还给内存池
+void freeObject(VM* vm, Obj* object) {
+    ObjType type = object->m_type;
+    object->~Obj();
+    vm->getPool().release(object, objectSize(type));
+}
+
+//VM销毁时只需逐个析构(释放string等成员持有的内存)，
+//对象本身所在的slab最后整块归还，不再一个个delete
+void freeObjects(VM* vm) {
+    Obj* object = vm->getObjects();
     while (object != NULL) {
         Obj* next = object->m_next;
-        freeObject(object);
+        object->~Obj();
         object = next;
     }
+    vm->changeObjects(nullptr);
+    vm->getPool().releaseAll();
 }
 
-void printObject(Value value) {
+//散列表可以直接或间接包含自己，正在输出的散列表再次出现时不再展开
+static thread_local std::vector<const ObjMap*> t_printing;
+
+void printObject(Value value, std::ostream& out) {
     switch (OBJ_TYPE(value)) {
         case OBJ_STRING:
-            std::cout<< AS_CSTRING(value);
+            out<< AS_CSTRING(value);
+        break;
+        case OBJ_NATIVE:
+            out<<"<native fn>";
+        break;
+        case OBJ_FUNCTION:
+            out<<"<fn "<<AS_FUNCTION(value)->m_name->m_string<<">";
+        break;
+        case OBJ_ARRAY: {
+            const std::vector<double>& values = AS_ARRAY(value)->m_values;
+            out<<"[";
+            for(size_t i = 0; i < values.size(); i++){
+                if(i > 0) out<<", ";
+                printValue(NUMBER_VAL(values[i]), out);
+            }
+            out<<"]";
         break;
+        }
+        case OBJ_MAP: {
+            const ObjMap* map = AS_MAP(value);
+            if(std::find(t_printing.begin(), t_printing.end(), map) != t_printing.end()){
+                out<<"{...}";
+                break;
+            }
+            t_printing.push_back(map);
+            bool first = true;
+            out<<"{";
+            for(size_t i = 0; i < map->m_entries.size(); i++){
+                if(map->m_ctrl[i] < 0) continue;    //空槽或已删除
+                if(!first) out<<", ";
+                first = false;
+                printValue(map->m_entries[i].key, out);
+                out<<": ";
+                printValue(map->m_entries[i].value, out);
+            }
+            out<<"}";
+            t_printing.pop_back();
+        break;
+        }
+        case OBJ_READER:
+            out<<"<reader "<<AS_READER(value)->m_path<<">";
+        break;
+        default: break;
     }
 }
 
-Obj* allocateObj(ObjType type){
+//新对象挂到所属VM的对象链表上，由该VM负责释放
+Obj* allocateObj(VM* vm, ObjType type){
     Obj* object = nullptr;
+    void* memory = vm->getPool().allocate(objectSize(type));
     switch(type){
-        case OBJ_STRING: object = new ObjString;
+        case OBJ_STRING: object = new (memory) ObjString; break;
+        case OBJ_NATIVE: object = new (memory) ObjNative; break;
+        case OBJ_FUNCTION: object = new (memory) ObjFunction; break;
+        case OBJ_ARRAY: object = new (memory) ObjArray; break;
+        case OBJ_MAP: object = new (memory) ObjMap; break;
+        case OBJ_READER: object = new (memory) ObjReader; break;
+        default: break;
     }
-    object->m_next = vm.getObjects();
-    vm.changeObjects(object);
+    object->m_next = vm->getObjects();
+    vm->changeObjects(object);
+    vm->countAllocation(type, objectSize(type));
     return object;
 }
 
-ObjString* makeString(std::string s, int length){
-    if(vm.countString(&s[0])){
-        return (ObjString*)AS_OBJ(vm.getString(&s[0]));
-    }
-    ObjString* p = (ObjString*)allocateObj(OBJ_STRING);
+//先用(字符, 散列值)查驻留表，没有时才创建对象。
+//owned不为空时是已经拼好的字符串，直接移交给新对象，不再复制
+static ObjString* internString(VM* vm, const char* chars, int length, std::string* owned){
+    uint32_t hash = hashString(chars, length);
+    ObjString* interned = vm->findString(chars, length, hash);
+    if(interned != nullptr) return interned;
+
+    ObjString* p = (ObjString*)allocateObj(vm, OBJ_STRING);
     p->m_length = length;
-    p->m_string = s;
+    if(owned != nullptr) p->m_string = std::move(*owned);
+    else p->m_string.assign(chars, length);
+    p->own();
+    p->m_hash = hash;
+    p->m_hashed = true;
+    vm->countAllocation(OBJ_STRING, length);
     //将新new的ObjString插入到VM的m_string上
-    vm.insertString(&s[0], OBJ_VAL(p));
-    return p;   
+    vm->insertString(p);
+    return p;
+}
+
+ObjString* makeString(VM* vm, std::string s, int length){
+    return internString(vm, s.data(), length, &s);
 }
 
 //堆上创建一个ObjString对象并返回其指针
 //若该string已经有了则直接返回
-ObjString* copyString(const char* chars, int length) {
-    if(vm.countString(chars)){
-        return (ObjString*)AS_OBJ(vm.getString(chars));
-    }
-    ObjString* p = (ObjString*)allocateObj(OBJ_STRING);
+ObjString* copyString(VM* vm, const char* chars, int length) {
+    return internString(vm, chars, length, nullptr);
+}
+
+//不查也不进驻留表，每次都是新对象。比较和散列都按内容，和驻留的字符串没有区别，散列值用到时再算
+ObjString* allocateString(VM* vm, const char* chars, int length){
+    ObjString* p = (ObjString*)allocateObj(vm, OBJ_STRING);
     p->m_length = length;
-    p->m_string = *chars++;
-    while(--length){
-        p->m_string+=*chars++;
-    }
-    //将新new的ObjString插入到VM的m_string上
-    vm.insertString(chars, OBJ_VAL(p));
+    p->m_string.assign(chars, length);
+    p->own();
+    vm->countAllocation(OBJ_STRING, length);
     return p;
+}
+
+Value keepString(VM* vm, Value value){
+    if(!IS_OBJ(value) || !IS_STRING(value) || !AS_STRING(value)->m_borrowed) return value;
+    ObjString* string = AS_STRING(value);
+    return OBJ_VAL(allocateString(vm, string->m_chars, string->m_length));
+}
+
+void mapSet(VM* vm, ObjMap* map, Value key, Value value){
+    value = keepString(vm, value);
+    Value old;
+    if(IS_OBJ(key) && IS_STRING(key) && AS_STRING(key)->m_borrowed && !map->get(key, &old)){
+        key = keepString(vm, key);
+    }
+    map->set(key, value);
 }
\ No newline at end of file
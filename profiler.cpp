@@ -0,0 +1,133 @@
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <iostream>
+#include "profiler.h"
+#include "vm.h"
+
+static thread_local VM* volatile t_vm = nullptr;
+static volatile bool s_running = false;
+static struct sigaction s_oldAction;
+
+static std::mutex s_lock;
+static std::map<std::string, uint64_t> s_stacks;   //折叠栈 -> 样本数
+static uint64_t s_dropped = 0;
+
+ProfileTable::ProfileTable(){
+    m_dropped = 0;
+}
+
+void ProfileTable::reserve(){
+    if(m_slots.empty()) m_slots.resize(PROFILE_SLOTS);
+}
+
+static bool sameStack(const ProfileSample& a, const ProfileSample& b){
+    if(a.hash != b.hash || a.chunk != b.chunk || a.line != b.line || a.depth != b.depth) return false;
+    int frames = a.depth < PROFILE_DEPTH ? a.depth : PROFILE_DEPTH;
+    for(int i = 0; i < frames; i++){
+        if(a.frames[i] != b.frames[i]) return false;
+    }
+    return true;
+}
+
+void ProfileTable::add(const ProfileSample& sample){
+    if(m_slots.empty()) return;
+    size_t mask = m_slots.size() - 1;
+    for(size_t i = 0; i < m_slots.size(); i++){
+        ProfileSample& slot = m_slots[(sample.hash + i) & mask];
+        if(slot.count == 0){
+            slot = sample;
+            slot.count = 1;
+            return;
+        }
+        if(sameStack(slot, sample)){
+            slot.count++;
+            return;
+        }
+    }
+    m_dropped++;
+}
+
+void ProfileTable::clear(){
+    for(ProfileSample& slot : m_slots) slot.count = 0;
+    m_dropped = 0;
+}
+
+//信号处理函数里只能做异步信号安全的事，具体见VM::takeSample
+static void onProfileSignal(int){
+    VM* vm = t_vm;
+    if(vm == nullptr) return;   //这个线程当前没有在执行脚本
+    vm->takeSample();
+}
+
+bool startProfiler(int hz){
+    if(s_running || hz <= 0) return false;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onProfileSignal;
+    action.sa_flags = SA_RESTART;   //被打断的read/write自动重启
+    sigemptyset(&action.sa_mask);
+    if(sigaction(SIGPROF, &action, &s_oldAction) != 0) return false;
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    if(setitimer(ITIMER_PROF, &timer, nullptr) != 0){
+        sigaction(SIGPROF, &s_oldAction, nullptr);
+        return false;
+    }
+    s_running = true;
+    return true;
+}
+
+void stopProfiler(){
+    if(!s_running) return;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    sigaction(SIGPROF, &s_oldAction, nullptr);
+    s_running = false;
+}
+
+bool profilerRunning(){
+    return s_running;
+}
+
+void profilerEnter(VM* vm){
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    t_vm = vm;
+}
+
+void profilerLeave(){
+    t_vm = nullptr;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+void profilerAddSamples(const std::string& stack, uint64_t count){
+    std::lock_guard<std::mutex> guard(s_lock);
+    s_stacks[stack] += count;
+}
+
+void profilerAddDropped(uint64_t count){
+    std::lock_guard<std::mutex> guard(s_lock);
+    s_dropped += count;
+}
+
+bool writeProfile(const std::string& path){
+    std::ofstream out(path);
+    if(!out.is_open()) return false;
+    std::lock_guard<std::mutex> guard(s_lock);
+    for(auto& stack : s_stacks){
+        out<<stack.first<<" "<<stack.second<<"\n";
+    }
+    if(s_dropped != 0){
+        std::cerr<<"profile: "<<s_dropped<<" samples dropped, more than "
+                 <<PROFILE_SLOTS<<" distinct stacks in one run"<<std::endl;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#include "recorder.h"
+#include "debug.h"
+
+FlightRecorder::FlightRecorder(){
+    clear();
+}
+
+void FlightRecorder::clear(){
+    m_count = 0;
+}
+
+static const char* topName(uint8_t top){
+    switch(top){
+        case VAL_BOOL:   return "bool";
+        case VAL_NIL:    return "nil";
+        case VAL_NUMBER: return "number";
+        case VAL_INT:    return "int";
+        case VAL_OBJ:    return "obj";
+        case RECORD_EMPTY: return "-";
+    }
+    return "?";
+}
+
+void FlightRecorder::dump(std::ostream& out) const{
+    uint64_t first = m_count > RECORDER_SIZE ? m_count - RECORDER_SIZE : 0;
+    out<<"== flight recorder: last "<<m_count - first<<" of "<<m_count<<" instructions =="<<std::endl;
+    for(uint64_t i = first; i < m_count; i++){
+        const Record& r = m_records[i & (RECORDER_SIZE - 1)];
+        char top[16];
+        snprintf(top, sizeof(top), "[%-6s] ", topName(r.top));
+        out<<top;
+        //记录和chunk对不上时只输出原始数据，不去解码越界的偏移
+        if(r.offset >= (uint32_t)r.chunk->getCount() || r.chunk->getCode(r.offset) != r.opcode){
+            out<<"offset "<<r.offset<<" opcode "<<(int)r.opcode<<" (not in this chunk)"<<std::endl;
+            continue;
+        }
+        disassembleInstruction(*r.chunk, r.offset, out);
+    }
+}
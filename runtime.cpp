@@ -0,0 +1,176 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include "runtime.h"
+#include "natives.h"
+#include "arrays.h"
+#include "hashmap.h"
+
+Runtime::Runtime(){
+}
+
+Runtime::~Runtime(){
+}
+
+Value* Runtime::stack(size_t size){
+    m_stack.assign(size, NIL_VAL);
+    return m_stack.data();
+}
+
+Value Runtime::string(const char* chars, int length){
+    return OBJ_VAL(copyString(&m_vm, chars, length));
+}
+
+Value Runtime::caseTable(std::initializer_list<Value> entries){
+    ObjMap* map = (ObjMap*)allocateObj(&m_vm, OBJ_MAP);
+    for(const Value* entry = entries.begin(); entry != entries.end(); entry += 2){
+        map->set(entry[0], entry[1]);
+    }
+    return OBJ_VAL(map);
+}
+
+bool Runtime::getGlobal(Value name, Value* value, int line){
+    if(!m_vm.getGlobal(AS_STRING(name)->m_string, value)){
+        error(line, "Undefined variable '%s'.", AS_STRING(name)->m_string.c_str());
+        return false;
+    }
+    return true;
+}
+
+void Runtime::defineGlobal(Value name, Value value){
+    m_vm.setGlobal(AS_STRING(name)->m_string, value);
+}
+
+bool Runtime::setGlobal(Value name, Value value, int line){
+    Value old;
+    if(!m_vm.getGlobal(AS_STRING(name)->m_string, &old)){
+        error(line, "Undefined variable '%s'.", AS_STRING(name)->m_string.c_str());
+        return false;
+    }
+    m_vm.setGlobal(AS_STRING(name)->m_string, value);
+    return true;
+}
+
+bool Runtime::add(Value a, Value b, Value* result, int line){
+    if(IS_OBJ(a) && IS_OBJ(b) && IS_STRING(a) && IS_STRING(b)){
+        std::string chars(AS_STRING(a)->view());
+        chars += AS_STRING(b)->view();
+        *result = OBJ_VAL(makeString(&m_vm, chars, chars.length()));
+        return true;
+    }
+    if(IS_NUMBER(a) && IS_NUMBER(b)){
+        *result = numberAdd(a, b);
+        return true;
+    }
+    error(line, "Operands must be two numbers or two strings.");
+    return false;
+}
+
+bool Runtime::call(Value* sp, int argCount, int line){
+    Value* callee = sp - argCount - 1;
+    if(!IS_OBJ(*callee) || !IS_NATIVE(*callee)){
+        error(line, "Can only call functions and classes.");
+        return false;
+    }
+    Value result;
+    if(!callNative(&m_vm, AS_NATIVE(*callee), argCount, sp - argCount, &result)){
+        error(line, "%s", AS_STRING(result)->m_string.c_str());
+        return false;
+    }
+    *callee = result;
+    return true;
+}
+
+bool Runtime::getIndex(Value array, Value index, Value* result, int line){
+    if(IS_OBJ(array) && IS_MAP(array)){
+        if(!AS_MAP(array)->get(index, result)) *result = NIL_VAL;
+        return true;
+    }
+    size_t slot;
+    const char* message = arraySlot(array, index, &slot);
+    if(message != nullptr){
+        error(line, "%s", message);
+        return false;
+    }
+    *result = NUMBER_VAL(AS_ARRAY(array)->m_values[slot]);
+    return true;
+}
+
+bool Runtime::setIndex(Value array, Value index, Value value, int line){
+    if(IS_OBJ(array) && IS_MAP(array)){
+        const char* message = mapKeyError(index);
+        if(message != nullptr){
+            error(line, "%s", message);
+            return false;
+        }
+        mapSet(&m_vm, AS_MAP(array), index, value);
+        return true;
+    }
+    size_t slot;
+    const char* message = arraySlot(array, index, &slot);
+    if(message != nullptr){
+        error(line, "%s", message);
+        return false;
+    }
+    if(!IS_NUMBER(value)){
+        error(line, "Array elements must be numbers.");
+        return false;
+    }
+    AS_ARRAY(array)->m_values[slot] = AS_NUMBER(value);
+    return true;
+}
+
+bool Runtime::map(Value* sp, int count, int line){
+    Value* entries = sp - 2 * count;
+    ObjMap* map = (ObjMap*)allocateObj(&m_vm, OBJ_MAP);
+    for(int i = 0; i < count; i++){
+        const char* message = mapKeyError(entries[2 * i]);
+        if(message != nullptr){
+            error(line, "%s", message);
+            return false;
+        }
+        mapSet(&m_vm, map, entries[2 * i], entries[2 * i + 1]);
+    }
+    entries[0] = OBJ_VAL(map);
+    return true;
+}
+
+bool Runtime::contains(Value key, Value map, Value* result, int line){
+    if(!IS_OBJ(map) || !IS_MAP(map)){
+        error(line, "Right operand of 'in' must be a map.");
+        return false;
+    }
+    Value value;
+    *result = BOOL_VAL(AS_MAP(map)->get(key, &value));
+    return true;
+}
+
+bool Runtime::remove(Value map, Value key, int line){
+    if(!IS_OBJ(map) || !IS_MAP(map)){
+        error(line, "Can only delete entries from a map.");
+        return false;
+    }
+    AS_MAP(map)->remove(key);
+    return true;
+}
+
+void Runtime::print(Value value){
+    printValue(value, m_vm.out());
+    m_vm.out()<<std::endl;
+}
+
+void Runtime::error(int line, const char* format, ...){
+    char message[1024];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    m_vm.err()<<message<<"\n";
+    m_vm.err()<<"[line "<<line<<"] in script"<<std::endl;
+}
+
+int Runtime::run(InterpretResult (*script)(Runtime&)){
+    InterpretResult result = script(*this);
+    if(result == INTERPRET_COMPILE_ERROR) return 65;
+    if(result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
@@ -1,13 +1,161 @@
+#include <array>
 #include "scanner.h"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+//字符类别表，用一次查表代替isAlpha/isDigit里的比较链
+enum{
+    CC_ALPHA    = 1 << 0,   //字母和下划线
+    CC_DIGIT    = 1 << 1,
+    CC_SPACE    = 1 << 2,   //' ' '\t' '\r' '\n'
+};
+
+static constexpr std::array<uint8_t, 256> makeCharClassTable(){
+    std::array<uint8_t, 256> table{};
+    for(int c = 'a'; c <= 'z'; c++) table[c] |= CC_ALPHA;
+    for(int c = 'A'; c <= 'Z'; c++) table[c] |= CC_ALPHA;
+    table['_'] |= CC_ALPHA;
+    for(int c = '0'; c <= '9'; c++) table[c] |= CC_DIGIT;
+    table[' '] |= CC_SPACE;
+    table['\t'] |= CC_SPACE;
+    table['\r'] |= CC_SPACE;
+    table['\n'] |= CC_SPACE;
+    return table;
+}
+
+static constexpr std::array<uint8_t, 256> charClass = makeCharClassTable();
+
+static inline bool isClass(char c, uint8_t cls){
+    return charClass[(uint8_t)c] & cls;
+}
+
 static bool isDigit(char c){
-    return c>='0' && c<='9';
+    return isClass(c, CC_DIGIT);
 }
 
 static bool isAlpha(char c) {
-  return (c >= 'a' && c <= 'z') ||
-         (c >= 'A' && c <= 'Z') ||
-          c == '_';
+    return isClass(c, CC_ALPHA);
+}
+
+//SIMD快速路径：一次比较16(SSE2)或32(AVX2)个字节，得到每个字节是否匹配的位掩码。
+//只在[p, end)内还有一整块时使用，剩余部分交给逐字节的循环，不会读越界。
+#if defined(__AVX2__)
+#define SCAN_BLOCK 32
+typedef __m256i Block;
+typedef uint32_t BlockMask;
+static const BlockMask FULL_MASK = 0xffffffffu;
+static inline Block load(const char* p){ return _mm256_loadu_si256((const __m256i*)p); }
+static inline Block eq(Block v, char c){ return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); }
+static inline Block gt(Block v, char c){ return _mm256_cmpgt_epi8(v, _mm256_set1_epi8(c)); }
+static inline Block lt(Block v, char c){ return _mm256_cmpgt_epi8(_mm256_set1_epi8(c), v); }
+static inline Block bor(Block a, Block b){ return _mm256_or_si256(a, b); }
+static inline Block bandnot(Block a, Block b){ return _mm256_andnot_si256(a, b); }   // ~a & b
+static inline Block ones(){ return _mm256_set1_epi8(-1); }
+static inline Block lower(Block v){ return _mm256_or_si256(v, _mm256_set1_epi8(0x20)); }
+static inline BlockMask mask(Block v){ return (BlockMask)_mm256_movemask_epi8(v); }
+#elif defined(__SSE2__)
+#define SCAN_BLOCK 16
+typedef __m128i Block;
+typedef uint32_t BlockMask;
+static const BlockMask FULL_MASK = 0xffffu;
+static inline Block load(const char* p){ return _mm_loadu_si128((const __m128i*)p); }
+static inline Block eq(Block v, char c){ return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+static inline Block gt(Block v, char c){ return _mm_cmpgt_epi8(v, _mm_set1_epi8(c)); }
+static inline Block lt(Block v, char c){ return _mm_cmplt_epi8(v, _mm_set1_epi8(c)); }
+static inline Block bor(Block a, Block b){ return _mm_or_si128(a, b); }
+static inline Block bandnot(Block a, Block b){ return _mm_andnot_si128(a, b); }     // ~a & b
+static inline Block ones(){ return _mm_set1_epi8(-1); }
+static inline Block lower(Block v){ return _mm_or_si128(v, _mm_set1_epi8(0x20)); }
+static inline BlockMask mask(Block v){ return (BlockMask)_mm_movemask_epi8(v); }
+#endif
+
+#ifdef SCAN_BLOCK
+//c在[lo, hi]内。源码里的ASCII字符都是正数，有符号比较即可
+static inline Block inRange(Block v, char lo, char hi){
+    return bandnot(bor(lt(v, lo), gt(v, hi)), ones());
+}
+
+//低n位
+static inline BlockMask lowBits(int n){
+    return n >= 32 ? 0xffffffffu : ((1u << n) - 1);
+}
+#endif
+
+//跳过连续空白，统计其中的换行，返回第一个非空白字符
+static const char* skipSpaces(const char* p, const char* end, int* line){
+#ifdef SCAN_BLOCK
+    while(p + SCAN_BLOCK <= end){
+        Block v = load(p);
+        BlockMask nl = mask(eq(v, '\n'));
+        BlockMask ws = nl | mask(bor(bor(eq(v, ' '), eq(v, '\t')), eq(v, '\r')));
+        if(ws != FULL_MASK){
+            int n = __builtin_ctz(~ws);
+            *line += __builtin_popcount(nl & lowBits(n));
+            return p + n;
+        }
+        *line += __builtin_popcount(nl);
+        p += SCAN_BLOCK;
+    }
+#endif
+    while(isClass(*p, CC_SPACE)){
+        if(*p == '\n') (*line)++;
+        p++;
+    }
+    return p;
+}
+
+//注释体：跳到换行符或源码末尾的'\0'，换行本身留给skipSpaces计数
+static const char* skipLine(const char* p, const char* end){
+#ifdef SCAN_BLOCK
+    while(p + SCAN_BLOCK <= end){
+        Block v = load(p);
+        BlockMask stop = mask(bor(eq(v, '\n'), eq(v, '\0')));
+        if(stop) return p + __builtin_ctz(stop);
+        p += SCAN_BLOCK;
+    }
+#endif
+    while(*p != '\n' && *p != '\0') p++;
+    return p;
+}
+
+//标识符剩余部分：[A-Za-z0-9_]*
+static const char* skipIdentifier(const char* p, const char* end){
+#ifdef SCAN_BLOCK
+    while(p + SCAN_BLOCK <= end){
+        Block v = load(p);
+        Block ident = bor(bor(inRange(lower(v), 'a', 'z'), inRange(v, '0', '9')), eq(v, '_'));
+        BlockMask m = mask(ident);
+        if(m != FULL_MASK) return p + __builtin_ctz(~m);
+        p += SCAN_BLOCK;
+    }
+#endif
+    while(isClass(*p, CC_ALPHA | CC_DIGIT)) p++;
+    return p;
+}
+
+//字符串体：跳到'"'或'\0'，统计其中的换行
+static const char* skipStringBody(const char* p, const char* end, int* line){
+#ifdef SCAN_BLOCK
+    while(p + SCAN_BLOCK <= end){
+        Block v = load(p);
+        BlockMask nl = mask(eq(v, '\n'));
+        BlockMask stop = mask(bor(eq(v, '"'), eq(v, '\0')));
+        if(stop){
+            int n = __builtin_ctz(stop);
+            *line += __builtin_popcount(nl & lowBits(n));
+            return p + n;
+        }
+        *line += __builtin_popcount(nl);
+        p += SCAN_BLOCK;
+    }
+#endif
+    while(*p != '"' && *p != '\0'){
+        if(*p == '\n') (*line)++;
+        p++;
+    }
+    return p;
 }
 
 bool Scanner::isAtEnd(){
@@ -55,77 +203,115 @@ Token Scanner::errorToken(const char* message){
 
 void Scanner::skipWhitespace(){
     for(;;){
-        char c = peek();
-        switch (c) {
-        case ' ':
-        case '\r':
-        case '\t':
-            advance();
-            break;
-        case '\n':
-            m_line++;
-            advance();
-            break;
-        case '/':
-            if (peekNext() == '/') {
-            // 注释可以当作空格来处理
-            // 若第二个不是 / 则上一个 / 不进行消费
-            while (peek() != '\n' && !isAtEnd()) advance();
-            } else {
+        m_current = skipSpaces(m_current, m_end, &m_line);
+        // 注释可以当作空格来处理
+        // 若第二个不是 / 则上一个 / 不进行消费
+        if(m_current[0] == '/' && m_current[1] == '/'){
+            m_current = skipLine(m_current + 2, m_end);
+        }else{
             return;
+        }
+    }
+}
+
+//关键字表，新增关键字只需要在这里加一行，散列参数在编译期重新搜索
+struct Keyword{
+    const char* name;
+    int length;
+    TokenType type;
+};
+
+static constexpr int cstrlen(const char* s){
+    int n = 0;
+    while(s[n]) n++;
+    return n;
+}
+
+#define KEYWORD(name, type) {name, cstrlen(name), type}
+static constexpr Keyword keywords[] = {
+    KEYWORD("and",    TOKEN_AND),
+    KEYWORD("case",   TOKEN_CASE),
+    KEYWORD("class",  TOKEN_CLASS),
+    KEYWORD("default", TOKEN_DEFAULT),
+    KEYWORD("delete", TOKEN_DELETE),
+    KEYWORD("else",   TOKEN_ELSE),
+    KEYWORD("false",  TOKEN_FALSE),
+    KEYWORD("for",    TOKEN_FOR),
+    KEYWORD("fun",    TOKEN_FUN),
+    KEYWORD("if",     TOKEN_IF),
+    KEYWORD("in",     TOKEN_IN),
+    KEYWORD("nil",    TOKEN_NIL),
+    KEYWORD("or",     TOKEN_OR),
+    KEYWORD("print",  TOKEN_PRINT),
+    KEYWORD("return", TOKEN_RETURN),
+    KEYWORD("super",  TOKEN_SUPER),
+    KEYWORD("switch", TOKEN_SWITCH),
+    KEYWORD("this",   TOKEN_THIS),
+    KEYWORD("true",   TOKEN_TRUE),
+    KEYWORD("var",    TOKEN_VAR),
+    KEYWORD("while",  TOKEN_WHILE),
+};
+#undef KEYWORD
+
+static constexpr int KEYWORD_COUNT = sizeof(keywords) / sizeof(keywords[0]);
+static constexpr int KEYWORD_SLOTS = 64;   //2的幂，取模变成按位与
+
+//散列只看长度和首尾字符：hash = (length + first*a + last*b) % KEYWORD_SLOTS
+struct KeywordSeed{
+    int a;
+    int b;
+};
+
+static constexpr unsigned keywordHash(KeywordSeed seed, int length, char first, char last){
+    return (unsigned)(length + (uint8_t)first * seed.a + (uint8_t)last * seed.b)
+           & (KEYWORD_SLOTS - 1);
+}
+
+//编译期搜索一组使所有关键字互不冲突的系数
+static constexpr KeywordSeed findKeywordSeed(){
+    for(int a = 1; a < 256; a++){
+        for(int b = 1; b < 256; b++){
+            bool used[KEYWORD_SLOTS] = {};
+            bool ok = true;
+            for(int i = 0; i < KEYWORD_COUNT && ok; i++){
+                const Keyword& kw = keywords[i];
+                unsigned h = keywordHash({a, b}, kw.length, kw.name[0], kw.name[kw.length - 1]);
+                if(used[h]) ok = false;
+                used[h] = true;
             }
-            break;
-        default:
-            return;
+            if(ok) return {a, b};
         }
     }
+    return {0, 0};
 }
 
-TokenType Scanner::checkKeyword(int start, int length, const char* rest, TokenType type) {
-  if (m_current - m_start == start + length && 
-        memcmp(m_start + start, rest, length) == 0) {
-    return type;
-  }
+static constexpr KeywordSeed keywordSeed = findKeywordSeed();
+static_assert(keywordSeed.a != 0, "no perfect hash for the keyword table, enlarge KEYWORD_SLOTS");
 
-  return TOKEN_IDENTIFIER;
+//槽位 -> 关键字，空槽长度为0，不会和任何标识符匹配
+static constexpr std::array<Keyword, KEYWORD_SLOTS> makeKeywordSlots(){
+    std::array<Keyword, KEYWORD_SLOTS> slots{};
+    for(int i = 0; i < KEYWORD_SLOTS; i++) slots[i] = {"", 0, TOKEN_IDENTIFIER};
+    for(int i = 0; i < KEYWORD_COUNT; i++){
+        const Keyword& kw = keywords[i];
+        slots[keywordHash(keywordSeed, kw.length, kw.name[0], kw.name[kw.length - 1])] = kw;
+    }
+    return slots;
 }
 
+static constexpr std::array<Keyword, KEYWORD_SLOTS> keywordSlots = makeKeywordSlots();
+
 TokenType Scanner::identifierType(){
-    switch (m_start[0]) {
-        case 'a': return checkKeyword(1, 2, "nd", TOKEN_AND);
-        case 'c': return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-        case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-        case 'f':
-            if (m_current - m_start > 1) {
-                switch (m_start[1]) {
-                case 'a': return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                case 'o': return checkKeyword(2, 1, "r", TOKEN_FOR);
-                case 'u': return checkKeyword(2, 1, "n", TOKEN_FUN);
-                }
-            }
-            break;
-        case 'i': return checkKeyword(1, 1, "f", TOKEN_IF);
-        case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
-        case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
-        case 'p': return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        case 'r': return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        case 's': return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-        case 't':
-            if (m_current - m_start > 1) {
-                switch (m_start[1]) {
-                case 'h': return checkKeyword(2, 2, "is", TOKEN_THIS);
-                case 'r': return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-                }
-            }
-            break;
-        case 'v': return checkKeyword(1, 2, "ar", TOKEN_VAR);
-        case 'w': return checkKeyword(1, 4, "hile", TOKEN_WHILE);
-  }
+    int length = (int)(m_current - m_start);
+    const Keyword& kw = keywordSlots[keywordHash(keywordSeed, length, m_start[0], m_current[-1])];
+    if(kw.length == length && memcmp(m_start, kw.name, length) == 0){
+        return kw.type;
+    }
     return TOKEN_IDENTIFIER;
 }
 
 Token Scanner::identifier(){
-    while (isAlpha(peek()) || isDigit(peek())) advance();
+    m_current = skipIdentifier(m_current, m_end);
     return makeToken(identifierType());
 }
 
@@ -143,10 +329,7 @@ Token Scanner::number(){
 }
 
 Token Scanner::string(){
-    while(peek() != '"' && !isAtEnd()){
-        if(peek() == '\n') m_line++;
-        advance();
-    }
+    m_current = skipStringBody(m_current, m_end, &m_line);
 
     if(isAtEnd()) return errorToken("Unterminated string.");
 
@@ -154,15 +337,22 @@ Token Scanner::string(){
     return makeToken(TOKEN_STRING);
 }
 
-Scanner::Scanner(const std::string& source){
-    m_start = &source[0];
-    m_current = &source[0];
+Scanner::Scanner(const std::string& source)
+    : Scanner(source.data(), source.size()){
+}
+
+//source[length]必须是'\0'，token直接指向这块内存，不做拷贝
+Scanner::Scanner(const char* source, size_t length){
+    m_start = source;
+    m_current = source;
+    m_end = source + length;
     m_line = 1;
 }
 
 Scanner::~Scanner(){
     m_current = nullptr;
     m_start = nullptr;
+    m_end = nullptr;
     m_line = -1;
 }
 
@@ -180,7 +370,10 @@ Token Scanner::scanToken(){
         case ')': return makeToken(TOKEN_RIGHT_PAREN);
         case '{': return makeToken(TOKEN_LEFT_BRACE);
         case '}': return makeToken(TOKEN_RIGHT_BRACE);
+        case '[': return makeToken(TOKEN_LEFT_BRACKET);
+        case ']': return makeToken(TOKEN_RIGHT_BRACKET);
         case ';': return makeToken(TOKEN_SEMICOLON);
+        case ':': return makeToken(TOKEN_COLON);
         case ',': return makeToken(TOKEN_COMMA);
         case '.': return makeToken(TOKEN_DOT);
         case '-': return makeToken(TOKEN_MINUS);
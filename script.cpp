@@ -0,0 +1,16 @@
+#include "script.h"
+
+Script::Script(){
+}
+
+Script::Script(std::shared_ptr<const Chunk> chunk)
+    : m_chunk(std::move(chunk)){
+}
+
+bool Script::isValid() const{
+    return m_chunk != nullptr;
+}
+
+const Chunk& Script::getChunk() const{
+    return *m_chunk;
+}
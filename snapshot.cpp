@@ -0,0 +1,426 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <fstream>
+#include <vector>
+#include <unordered_map>
+#include "snapshot.h"
+#include "vm.h"
+#include "object.h"
+#include "source.h"
+#include "verifier.h"
+#include "infer.h"
+
+//保存时整个文件先拼在内存里，最后一次写出
+typedef struct{
+    std::string bytes;
+    std::unordered_map<Obj*, uint32_t> index;   //对象在快照里的编号
+    std::vector<Obj*> objects;      //按编号排列，编号时同时当作广度优先的队列
+} Writer;
+
+static void writeBytes(Writer* writer, const void* data, size_t size){
+    writer->bytes.append((const char*)data, size);
+}
+
+static void writeU8(Writer* writer, uint8_t value){
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeU32(Writer* writer, uint32_t value){
+    writeBytes(writer, &value, sizeof(value));
+}
+
+static void writeText(Writer* writer, const std::string& text){
+    writeU32(writer, (uint32_t)text.size());
+    writeBytes(writer, text.data(), text.size());
+}
+
+static void numberObject(Writer* writer, Obj* object){
+    if(writer->index.emplace(object, (uint32_t)writer->objects.size()).second){
+        writer->objects.push_back(object);
+    }
+}
+
+static void numberValue(Writer* writer, Value value){
+    if(IS_OBJ(value)) numberObject(writer, AS_OBJ(value));
+}
+
+static void writeValue(Writer* writer, Value value){
+    writeU8(writer, (uint8_t)value.type);
+    switch(value.type){
+        case VAL_BOOL:   writeU8(writer, AS_BOOL(value)); break;
+        case VAL_NIL:    break;
+        case VAL_NUMBER: writeBytes(writer, &value.as.number, sizeof(double)); break;
+        case VAL_INT:    writeBytes(writer, &value.as.integer, sizeof(int32_t)); break;
+        case VAL_OBJ:    writeU32(writer, writer->index.find(AS_OBJ(value))->second); break;
+    }
+}
+
+static void writeFunction(Writer* writer, ObjFunction* function){
+    const Chunk& chunk = function->m_chunk;
+    writeU32(writer, (uint32_t)function->m_arity);
+    writeU32(writer, writer->index.find(function->m_name)->second);
+    writeU32(writer, (uint32_t)chunk.getCount());
+    writeBytes(writer, chunk.getFirstCode(), chunk.getCount());
+
+    size_t runCount = writer->bytes.size();
+    writeU32(writer, 0);
+    uint32_t runs = 0;
+    for(int start = 0; start < chunk.getCount();){
+        int end = start + 1;
+        while(end < chunk.getCount() && chunk.getLine(end) == chunk.getLine(start)) end++;
+        writeU32(writer, (uint32_t)chunk.getLine(start));
+        writeU32(writer, (uint32_t)(end - start));
+        runs++;
+        start = end;
+    }
+    memcpy(&writer->bytes[runCount], &runs, sizeof(runs));
+
+    writeU32(writer, (uint32_t)chunk.getConstantCount());
+    for(int i = 0; i < chunk.getConstantCount(); i++) writeValue(writer, chunk.getConstant(i));
+}
+
+static void writeObject(Writer* writer, Obj* object){
+    writeU8(writer, (uint8_t)object->m_type);
+    size_t sizeAt = writer->bytes.size();
+    writeU32(writer, 0);
+    size_t start = writer->bytes.size();
+    switch(object->m_type){
+        case OBJ_STRING: {
+            std::string_view chars = ((ObjString*)object)->view();
+            writeBytes(writer, chars.data(), chars.size());
+            break;
+        }
+        case OBJ_NATIVE: {
+            const std::string& name = ((ObjNative*)object)->m_name;
+            writeBytes(writer, name.data(), name.size());
+            break;
+        }
+        case OBJ_FUNCTION:
+            writeFunction(writer, (ObjFunction*)object);
+            break;
+        case OBJ_ARRAY: {
+            const std::vector<double>& values = ((ObjArray*)object)->m_values;
+            writeBytes(writer, values.data(), values.size() * sizeof(double));
+            break;
+        }
+        case OBJ_MAP: {
+            ObjMap* map = (ObjMap*)object;
+            writeU32(writer, (uint32_t)map->m_count);
+            for(size_t i = 0; i < map->m_ctrl.size(); i++){
+                if(map->m_ctrl[i] < 0) continue;    //空槽或已删除
+                writeValue(writer, map->m_entries[i].key);
+                writeValue(writer, map->m_entries[i].value);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    uint32_t size = (uint32_t)(writer->bytes.size() - start);
+    memcpy(&writer->bytes[sizeAt], &size, sizeof(size));
+}
+
+bool VM::saveSnapshot(const std::string& path){
+    if(isSuspended()){
+        *m_err<<"Cannot save a snapshot while a script is suspended."<<std::endl;
+        return false;
+    }
+
+    //从全局变量出发给能到达的对象编号，没有引用的对象不保存
+    Writer writer;
+    for(auto& global : m_globals) numberValue(&writer, global.second);
+    for(size_t i = 0; i < writer.objects.size(); i++){
+        Obj* object = writer.objects[i];
+        switch(object->m_type){
+            case OBJ_FUNCTION: {
+                ObjFunction* function = (ObjFunction*)object;
+                numberObject(&writer, function->m_name);
+                for(int j = 0; j < function->m_chunk.getConstantCount(); j++){
+                    numberValue(&writer, function->m_chunk.getConstant(j));
+                }
+                break;
+            }
+            case OBJ_MAP: {
+                ObjMap* map = (ObjMap*)object;
+                for(size_t j = 0; j < map->m_ctrl.size(); j++){
+                    if(map->m_ctrl[j] < 0) continue;
+                    numberValue(&writer, map->m_entries[j].key);
+                    numberValue(&writer, map->m_entries[j].value);
+                }
+                break;
+            }
+            case OBJ_READER:
+                //打开的文件和读到的位置属于这个进程，没法搬到别的进程里
+                *m_err<<"Cannot save a snapshot: a file reader is reachable from the globals."<<std::endl;
+                return false;
+            default:
+                break;
+        }
+    }
+
+    writeBytes(&writer, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    writeU32(&writer, SNAPSHOT_VERSION);
+    writeU32(&writer, SNAPSHOT_BYTE_ORDER);
+    writeU32(&writer, (uint32_t)writer.objects.size());
+    writeU32(&writer, (uint32_t)m_globals.size());
+    for(Obj* object : writer.objects) writeObject(&writer, object);
+    for(auto& global : m_globals){
+        writeText(&writer, global.first);
+        writeValue(&writer, global.second);
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(writer.bytes.data(), writer.bytes.size());
+    out.close();
+    if(!out){
+        *m_err<<"could not write file "<<path<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+//加载时按区间读映射进来的文件，每次读之前检查剩余长度
+typedef struct{
+    const uint8_t* at;
+    const uint8_t* end;
+} Reader;
+
+static bool readBytes(Reader* reader, void* out, size_t size){
+    if((size_t)(reader->end - reader->at) < size) return false;
+    memcpy(out, reader->at, size);
+    reader->at += size;
+    return true;
+}
+
+static bool readU8(Reader* reader, uint8_t* value){
+    return readBytes(reader, value, sizeof(*value));
+}
+
+static bool readU32(Reader* reader, uint32_t* value){
+    return readBytes(reader, value, sizeof(*value));
+}
+
+//跳过size字节，返回它们的起点，不够时返回nullptr
+static const uint8_t* skip(Reader* reader, size_t size){
+    if((size_t)(reader->end - reader->at) < size) return nullptr;
+    const uint8_t* start = reader->at;
+    reader->at += size;
+    return start;
+}
+
+typedef struct{
+    VM* vm;
+    std::vector<Obj*> objects;      //快照里的编号对应的对象
+    std::vector<Reader> records;    //每个对象的内容
+    std::string error;
+} Loader;
+
+static bool corrupt(Loader* loader, const char* format, ...){
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    loader->error = message;
+    return false;
+}
+
+static bool readValue(Loader* loader, Reader* reader, Value* value){
+    uint8_t type;
+    if(!readU8(reader, &type)) return corrupt(loader, "truncated value.");
+    switch(type){
+        case VAL_BOOL: {
+            uint8_t boolean;
+            if(!readU8(reader, &boolean)) return corrupt(loader, "truncated value.");
+            *value = BOOL_VAL(boolean != 0);
+            return true;
+        }
+        case VAL_NIL:
+            *value = NIL_VAL;
+            return true;
+        case VAL_NUMBER: {
+            double number;
+            if(!readBytes(reader, &number, sizeof(number))) return corrupt(loader, "truncated value.");
+            *value = NUMBER_VAL(number);
+            return true;
+        }
+        case VAL_INT: {
+            int32_t integer;
+            if(!readBytes(reader, &integer, sizeof(integer))) return corrupt(loader, "truncated value.");
+            *value = INT_VAL(integer);
+            return true;
+        }
+        case VAL_OBJ: {
+            uint32_t index;
+            if(!readU32(reader, &index)) return corrupt(loader, "truncated value.");
+            if(index >= loader->objects.size()) return corrupt(loader, "object %u out of range.", index);
+            *value = OBJ_VAL(loader->objects[index]);
+            return true;
+        }
+        default:
+            return corrupt(loader, "unknown value type %d.", type);
+    }
+}
+
+static bool readFunction(Loader* loader, Reader* reader, ObjFunction* function){
+    uint32_t arity, name, codeCount, runCount, constantCount;
+    if(!readU32(reader, &arity) || !readU32(reader, &name)) return corrupt(loader, "truncated function.");
+    if(arity >= UINT8_COUNT) return corrupt(loader, "function arity %u out of range.", arity);
+    if(name >= loader->objects.size() || loader->objects[name]->m_type != OBJ_STRING){
+        return corrupt(loader, "function name %u is not a string.", name);
+    }
+    function->m_arity = (int)arity;
+    function->m_name = (ObjString*)loader->objects[name];
+
+    const uint8_t* code;
+    if(!readU32(reader, &codeCount) || !(code = skip(reader, codeCount)) || !readU32(reader, &runCount)){
+        return corrupt(loader, "truncated function.");
+    }
+    Chunk& chunk = function->m_chunk;
+    for(uint32_t i = 0; i < runCount; i++){
+        uint32_t line, count;
+        if(!readU32(reader, &line) || !readU32(reader, &count)) return corrupt(loader, "truncated function.");
+        if(count > codeCount - (uint32_t)chunk.getCount()) return corrupt(loader, "line table longer than code.");
+        chunk.writeCode(code + chunk.getCount(), (int)count, (int)line);
+    }
+    if((uint32_t)chunk.getCount() != codeCount) return corrupt(loader, "line table shorter than code.");
+
+    if(!readU32(reader, &constantCount)) return corrupt(loader, "truncated function.");
+    for(uint32_t i = 0; i < constantCount; i++){
+        Value constant;
+        if(!readValue(loader, reader, &constant)) return false;
+        chunk.addConstant(constant);
+    }
+    return true;
+}
+
+static bool readObject(Loader* loader, Reader* reader, Obj* object){
+    switch(object->m_type){
+        case OBJ_FUNCTION:
+            if(!readFunction(loader, reader, (ObjFunction*)object)) return false;
+            break;
+        case OBJ_ARRAY: {
+            size_t size = reader->end - reader->at;
+            if(size % sizeof(double) != 0) return corrupt(loader, "array size %zu is not a multiple of 8.", size);
+            std::vector<double>& values = ((ObjArray*)object)->m_values;
+            values.resize(size / sizeof(double));
+            readBytes(reader, values.data(), size);
+            break;
+        }
+        case OBJ_MAP: {
+            //键的散列值可能依赖对象地址，逐个重新插入
+            uint32_t count;
+            if(!readU32(reader, &count)) return corrupt(loader, "truncated map.");
+            for(uint32_t i = 0; i < count; i++){
+                Value key, value;
+                if(!readValue(loader, reader, &key) || !readValue(loader, reader, &value)) return false;
+                ((ObjMap*)object)->set(key, value);
+            }
+            break;
+        }
+        default:    //字符串和原生函数在第一遍已经完成
+            return true;
+    }
+    if(reader->at != reader->end) return corrupt(loader, "trailing bytes in object.");
+    return true;
+}
+
+//globals收到快照里的全局变量，全部检查通过之后才由调用者写进VM
+static bool readSnapshot(Loader* loader, const uint8_t* data, size_t size,
+                         std::vector<std::pair<std::string, Value>>* globals){
+    Reader reader = {data, data + size};
+    char magic[SNAPSHOT_MAGIC_SIZE];
+    uint32_t version, byteOrder, objectCount, globalCount;
+    if(!readBytes(&reader, magic, sizeof(magic)) || memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0){
+        return corrupt(loader, "not a snapshot file.");
+    }
+    if(!readU32(&reader, &version) || !readU32(&reader, &byteOrder) ||
+       !readU32(&reader, &objectCount) || !readU32(&reader, &globalCount)){
+        return corrupt(loader, "truncated header.");
+    }
+    if(version != SNAPSHOT_VERSION) return corrupt(loader, "unsupported version %u.", version);
+    if(byteOrder != SNAPSHOT_BYTE_ORDER) return corrupt(loader, "written on a machine with a different byte order.");
+
+    //原生函数不保存指针，按名字换成本VM注册的
+    std::unordered_map<std::string, ObjNative*> natives;
+    for(Obj* object = loader->vm->getObjects(); object != nullptr; object = object->m_next){
+        if(object->m_type == OBJ_NATIVE) natives.emplace(((ObjNative*)object)->m_name, (ObjNative*)object);
+    }
+
+    //第一遍：字符串和原生函数直接得到，其余对象先建空壳，内容里可以引用后面的对象
+    for(uint32_t i = 0; i < objectCount; i++){
+        uint8_t type;
+        uint32_t length;
+        const uint8_t* body;
+        if(!readU8(&reader, &type) || !readU32(&reader, &length) || !(body = skip(&reader, length))){
+            return corrupt(loader, "truncated object %u.", i);
+        }
+        loader->records.push_back(Reader{body, body + length});
+        Obj* object;
+        switch(type){
+            case OBJ_STRING:
+                if(length > INT32_MAX) return corrupt(loader, "string %u too long.", i);
+                object = copyString(loader->vm, (const char*)body, (int)length);
+                break;
+            case OBJ_NATIVE: {
+                auto it = natives.find(std::string((const char*)body, length));
+                if(it == natives.end()){
+                    return corrupt(loader, "unknown native '%.*s'.", (int)length, (const char*)body);
+                }
+                object = it->second;
+                break;
+            }
+            case OBJ_FUNCTION:
+            case OBJ_ARRAY:
+            case OBJ_MAP:
+                object = allocateObj(loader->vm, (ObjType)type);
+                break;
+            default:
+                return corrupt(loader, "object %u has unknown type %d.", i, type);
+        }
+        loader->objects.push_back(object);
+    }
+
+    //第二遍：填入内容
+    for(uint32_t i = 0; i < objectCount; i++){
+        if(!readObject(loader, &loader->records[i], loader->objects[i])) return false;
+    }
+
+    for(uint32_t i = 0; i < globalCount; i++){
+        uint32_t length;
+        const uint8_t* name;
+        Value value;
+        if(!readU32(&reader, &length) || !(name = skip(&reader, length))) return corrupt(loader, "truncated global.");
+        if(!readValue(loader, &reader, &value)) return false;
+        globals->emplace_back(std::string((const char*)name, length), value);
+    }
+    if(reader.at != reader.end) return corrupt(loader, "trailing bytes after globals.");
+
+    //字节码来自文件，和编译出来的一样先验证；_NUM操作码不信任文件，按类型推断重新选择
+    for(Obj* object : loader->objects){
+        if(object->m_type != OBJ_FUNCTION) continue;
+        if(!verifyFunction((ObjFunction*)object, &loader->error)) return false;
+    }
+    for(Obj* object : loader->objects){
+        if(object->m_type == OBJ_FUNCTION) specializeFunction((ObjFunction*)object);
+    }
+    return true;
+}
+
+bool VM::loadSnapshot(const std::string& path){
+    SourceFile file;
+    if(!file.open(path)){
+        *m_err<<"could not open file "<<path<<std::endl;
+        return false;
+    }
+    Loader loader;
+    loader.vm = this;
+    std::vector<std::pair<std::string, Value>> globals;
+    if(!readSnapshot(&loader, (const uint8_t*)file.data(), file.size(), &globals)){
+        *m_err<<"Invalid snapshot "<<path<<": "<<loader.error<<std::endl;
+        return false;
+    }
+    for(auto& global : globals) m_globals[global.first] = global.second;
+    return true;
+}
@@ -0,0 +1,91 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "source.h"
+
+SourceFile::SourceFile(){
+    m_data = "";
+    m_size = 0;
+    m_map = nullptr;
+    m_mapSize = 0;
+}
+
+SourceFile::~SourceFile(){
+    close();
+}
+
+void SourceFile::close(){
+    if(m_map != nullptr){
+        munmap(m_map, m_mapSize);
+        m_map = nullptr;
+        m_mapSize = 0;
+    }
+    m_buffer.clear();
+    m_data = "";
+    m_size = 0;
+}
+
+bool SourceFile::mapFile(int fd, size_t size){
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    //文件占用的页再加一页零页作为哨兵
+    size_t mapSize = (size + pageSize - 1) / pageSize * pageSize + pageSize;
+
+    void* base = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) return false;
+    //文件覆盖在前面，最后一页文件末尾之后的字节由内核填0
+    if(mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED){
+        munmap(base, mapSize);
+        return false;
+    }
+    madvise(base, mapSize, MADV_SEQUENTIAL);
+
+    m_map = base;
+    m_mapSize = mapSize;
+    m_data = (const char*)base;
+    m_size = size;
+    return true;
+}
+
+bool SourceFile::readFile(int fd){
+    char chunk[65536];
+    ssize_t n;
+    while((n = read(fd, chunk, sizeof(chunk))) > 0){
+        m_buffer.append(chunk, n);
+    }
+    if(n < 0) return false;
+    m_data = m_buffer.c_str();
+    m_size = m_buffer.size();
+    return true;
+}
+
+bool SourceFile::open(const std::string& path){
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) return false;
+
+    struct stat st;
+    bool ok = false;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+        ok = mapFile(fd, (size_t)st.st_size);
+    }
+    if(!ok) ok = readFile(fd);
+    ::close(fd);    //映射建立后可以关闭描述符
+    return ok;
+}
+
+void SourceFile::release(size_t from, size_t to){
+    if(m_map == nullptr) return;
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = (from + pageSize - 1) / pageSize * pageSize;
+    size_t end = to / pageSize * pageSize;
+    if(end > start) madvise((char*)m_map + start, end - start, MADV_DONTNEED);
+}
+
+const char* SourceFile::data() const{
+    return m_data;
+}
+
+size_t SourceFile::size() const{
+    return m_size;
+}
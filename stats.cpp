@@ -0,0 +1,20 @@
+#include "stats.h"
+
+void printStatsJson(const VMStats& stats, std::ostream& out){
+    out<<"{\n";
+    out<<"  \"compile_ns\": "<<stats.compileNs<<",\n";
+    out<<"  \"chunk_bytes\": "<<stats.chunkBytes<<",\n";
+    out<<"  \"constants\": "<<stats.constants<<",\n";
+    out<<"  \"instructions\": "<<stats.instructions<<",\n";
+    out<<"  \"reserved_stack\": "<<stats.reservedStack<<",\n";
+    out<<"  \"objects\": {";
+    for(int type = 0; type < OBJ_TYPE_COUNT; type++){
+        out<<(type == 0 ? "\n" : ",\n");
+        out<<"    \""<<objTypeName((ObjType)type)<<"\": {\"count\": "<<stats.objects[type]
+           <<", \"bytes\": "<<stats.objectBytes[type]<<"}";
+    }
+    out<<"\n  },\n";
+    out<<"  \"interned_strings\": "<<stats.internedStrings<<",\n";
+    out<<"  \"execute_ns\": "<<stats.executeNs<<"\n";
+    out<<"}"<<std::endl;
+}
@@ -0,0 +1,87 @@
+#include <string.h>
+#include <stdint.h>
+#include "text.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define TEXT_BLOCK 32
+typedef __m256i Block;
+static inline Block load(const char* p){ return _mm256_loadu_si256((const __m256i*)p); }
+static inline void store(char* p, Block v){ _mm256_storeu_si256((__m256i*)p, v); }
+static inline Block splat(char c){ return _mm256_set1_epi8(c); }
+static inline Block eq(Block a, Block b){ return _mm256_cmpeq_epi8(a, b); }
+static inline Block gt(Block a, Block b){ return _mm256_cmpgt_epi8(a, b); }
+static inline Block band(Block a, Block b){ return _mm256_and_si256(a, b); }
+static inline Block bxor(Block a, Block b){ return _mm256_xor_si256(a, b); }
+static inline uint32_t mask(Block v){ return (uint32_t)_mm256_movemask_epi8(v); }
+#elif defined(__SSE2__)
+#define TEXT_BLOCK 16
+typedef __m128i Block;
+static inline Block load(const char* p){ return _mm_loadu_si128((const __m128i*)p); }
+static inline void store(char* p, Block v){ _mm_storeu_si128((__m128i*)p, v); }
+static inline Block splat(char c){ return _mm_set1_epi8(c); }
+static inline Block eq(Block a, Block b){ return _mm_cmpeq_epi8(a, b); }
+static inline Block gt(Block a, Block b){ return _mm_cmpgt_epi8(a, b); }
+static inline Block band(Block a, Block b){ return _mm_and_si128(a, b); }
+static inline Block bxor(Block a, Block b){ return _mm_xor_si128(a, b); }
+static inline uint32_t mask(Block v){ return (uint32_t)_mm_movemask_epi8(v); }
+#endif
+
+//一块里同时比较needle的首字节和尾字节，两者都对上的位置才用memcmp确认中间部分。
+//对日志这类文本，首尾同时命中的位置很少，大部分块一次比较就跳过
+const char* findText(const char* haystack, size_t length, const char* needle, size_t needleLength){
+    if(needleLength == 0) return haystack;
+    if(needleLength > length) return nullptr;
+    if(needleLength == 1) return (const char*)memchr(haystack, needle[0], length);
+
+    size_t last = needleLength - 1;
+    size_t end = length - last;     //候选起点的个数
+    size_t i = 0;
+#ifdef TEXT_BLOCK
+    Block first = splat(needle[0]);
+    Block tail = splat(needle[last]);
+    for(; i + TEXT_BLOCK <= end; i += TEXT_BLOCK){
+        uint32_t hits = mask(band(eq(load(haystack + i), first), eq(load(haystack + i + last), tail)));
+        for(; hits != 0; hits &= hits - 1){
+            size_t start = i + __builtin_ctz(hits);
+            if(memcmp(haystack + start + 1, needle + 1, last - 1) == 0) return haystack + start;
+        }
+    }
+#endif
+    for(; i < end; i++){
+        if(haystack[i] == needle[0] && haystack[i + last] == needle[last] &&
+           memcmp(haystack + i + 1, needle + 1, last - 1) == 0){
+            return haystack + i;
+        }
+    }
+    return nullptr;
+}
+
+//[lo, hi]内的字节翻转0x20这一位。有符号比较，0x80以上的字节是负数，不会落在范围内
+static void flipCase(char* chars, size_t length, char lo, char hi){
+    size_t i = 0;
+#ifdef TEXT_BLOCK
+    Block below = splat(lo - 1);
+    Block above = splat(hi + 1);
+    Block bit = splat(0x20);
+    for(; i + TEXT_BLOCK <= length; i += TEXT_BLOCK){
+        Block v = load(chars + i);
+        Block inRange = band(gt(v, below), gt(above, v));
+        store(chars + i, bxor(v, band(inRange, bit)));
+    }
+#endif
+    for(; i < length; i++){
+        if(chars[i] >= lo && chars[i] <= hi) chars[i] ^= 0x20;
+    }
+}
+
+void upperText(char* chars, size_t length){
+    flipCase(chars, length, 'a', 'z');
+}
+
+void lowerText(char* chars, size_t length){
+    flipCase(chars, length, 'A', 'Z');
+}
@@ -3,27 +3,39 @@
 #include <stdio.h>
 
 bool valuesEqual(Value a, Value b) {
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    if (IS_INT(a) && IS_INT(b)) return AS_INT(a) == AS_INT(b);
+    return AS_NUMBER(a) == AS_NUMBER(b);
+  }
   if (a.type != b.type) return false;
   switch (a.type) {
     case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
     case VAL_NIL:    return true;
     case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
     case VAL_OBJ: {
+        //冻结的chunk里有字符串的副本，字符串按内容比较，其他对象按身份比较
+        if (!IS_STRING(a) || !IS_STRING(b)) return AS_OBJ(a) == AS_OBJ(b);
         ObjString* aString = AS_STRING(a);
         ObjString* bString = AS_STRING(b);
-        return aString->m_string == bString->m_string;
+        return aString->view() == bString->view();
         }
     default:         return false; // Unreachable.
   }
 }
 
-void printValue(Value value){
+void printValue(Value value, std::ostream& out){
     switch (value.type) {
     case VAL_BOOL:
-      printf(AS_BOOL(value) ? "true" : "false");
+      out<<(AS_BOOL(value) ? "true" : "false");
+      break;
+    case VAL_NIL: out<<"nil"; break;
+    case VAL_NUMBER:
+    case VAL_INT: {
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
+      out<<buffer;
       break;
-    case VAL_NIL: printf("nil"); break;
-    case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-    case VAL_OBJ: printObject(value); break;
+    }
+    case VAL_OBJ: printObject(value, out); break;
   }
 }
\ No newline at end of file
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <vector>
+#include <unordered_map>
+#include "verifier.h"
+#include "value.h"
+#include "object.h"
+
+//固定的栈效果：执行前栈上至少要有needed个值，执行后深度加effect。
+//needed为VARIABLE的指令栈效果取决于操作数或者会改变控制流，在循环里单独处理
+#define VARIABLE -1
+
+typedef struct{
+    int8_t needed;
+    int8_t effect;
+} StackEffect;
+
+static const StackEffect stackEffects[] = {
+    [OP_CONSTANT]           = {0, 1},
+    [OP_CONSTANT_LONG]      = {0, 1},
+    [OP_NIL]                = {0, 1},
+    [OP_TRUE]               = {0, 1},
+    [OP_FALSE]              = {0, 1},
+    [OP_POP]                = {1, -1},
+    [OP_GET_LOCAL]          = {VARIABLE, 0},
+    [OP_SET_LOCAL]          = {VARIABLE, 0},
+    [OP_GET_GLOBAL]         = {0, 1},
+    [OP_GET_GLOBAL_LONG]    = {0, 1},
+    [OP_DEFINE_GLOBAL]      = {1, -1},
+    [OP_DEFINE_GLOBAL_LONG] = {1, -1},
+    [OP_SET_GLOBAL]         = {1, 0},
+    [OP_SET_GLOBAL_LONG]    = {1, 0},
+    [OP_EQUAL]              = {2, -1},
+    [OP_GREATER]            = {2, -1},
+    [OP_LESS]               = {2, -1},
+    [OP_ADD]                = {2, -1},
+    [OP_SUBTRACT]           = {2, -1},
+    [OP_MULTIPLY]           = {2, -1},
+    [OP_DIVIDE]             = {2, -1},
+    [OP_NOT]                = {1, 0},
+    [OP_NEGATE]             = {1, 0},
+    [OP_GREATER_NUM]        = {2, -1},
+    [OP_LESS_NUM]           = {2, -1},
+    [OP_ADD_NUM]            = {2, -1},
+    [OP_SUBTRACT_NUM]       = {2, -1},
+    [OP_MULTIPLY_NUM]       = {2, -1},
+    [OP_DIVIDE_NUM]         = {2, -1},
+    [OP_NEGATE_NUM]         = {1, 0},
+    [OP_PRINT]              = {1, -1},
+    [OP_JUMP]               = {VARIABLE, 0},
+    [OP_JUMP_IF_FALSE]      = {1, 0},   //条件留在栈上，由后面的OP_POP弹出
+    [OP_LOOP]               = {VARIABLE, 0},
+    [OP_CALL]               = {VARIABLE, 0},
+    [OP_GET_INDEX]          = {2, -1},
+    [OP_SET_INDEX]          = {3, -2},  //新值留在栈上
+    [OP_MAP]                = {VARIABLE, 0},
+    [OP_IN]                 = {2, -1},
+    [OP_DELETE]             = {2, -2},
+    [OP_FOR_TEST]           = {VARIABLE, 0},
+    [OP_FOR_STEP]           = {VARIABLE, 0},
+    [OP_JUMP_TABLE]         = {VARIABLE, 0},
+    [OP_CASE_TABLE]         = {VARIABLE, 0},
+    [OP_RETURN]             = {VARIABLE, 0},
+};
+static_assert(sizeof(stackEffects) / sizeof(stackEffects[0]) == OP_RETURN + 1, "every opcode needs a stack effect");
+
+//和编译错误一样带上行号，再加上函数名和偏移，方便对照反汇编
+static bool fail(const Chunk& chunk, const char* name, int offset, std::string* error, const char* format, ...){
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    char prefix[128];
+    int line = offset < chunk.getCount() ? chunk.getLine(offset) : chunk.getLine(chunk.getCount() - 1);
+    snprintf(prefix, sizeof(prefix), "[line %d] Invalid bytecode in %s at offset %d: ", line, name, offset);
+    *error = std::string(prefix) + message;
+    return false;
+}
+
+//entryDepth是进入时栈上已有的槽位：顶层脚本是0，函数是被调用者本身加上参数
+static bool verifyCode(Chunk* chunk, const char* name, int entryDepth, std::string* error){
+    int count = chunk->getCount();
+    if(count == 0){
+        *error = std::string("Invalid bytecode in ") + name + ": chunk is empty.";
+        return false;
+    }
+    const uint8_t* code = chunk->getFirstCode();
+    int constants = chunk->getConstantCount();
+
+    //第一遍顺序解码：标出指令开头，检查操作数本身是否合法
+    std::vector<bool> boundary(count, false);
+    std::vector<int> branches;      //所有跳转指令的偏移
+    for(int offset = 0; offset < count;){
+        uint8_t instruction = code[offset];
+        int length = instructionLength(instruction);
+        if(length == 0) return fail(*chunk, name, offset, error, "unknown opcode %d.", instruction);
+        if(offset + length > count) return fail(*chunk, name, offset, error, "instruction is truncated.");
+        //跳转表的长度要读过固定部分才知道
+        if(isSwitch(instruction)){
+            length = switchLength(code, offset);
+            if(offset + length > count) return fail(*chunk, name, offset, error, "instruction is truncated.");
+        }
+        boundary[offset] = true;
+
+        int constant = -1;
+        switch(instruction){
+            case OP_CONSTANT:
+                constant = code[offset + 1];
+                break;
+            case OP_CONSTANT_LONG:
+                constant = chunk->getLong(offset + 1);
+                break;
+            case OP_GET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_GET_GLOBAL_LONG:
+            case OP_DEFINE_GLOBAL_LONG:
+            case OP_SET_GLOBAL_LONG:
+                constant = length == 2 ? code[offset + 1] : chunk->getLong(offset + 1);
+                if(constant < constants){
+                    Value global = chunk->getConstant(constant);
+                    if(!IS_OBJ(global) || !IS_STRING(global)){
+                        return fail(*chunk, name, offset, error, "global name %d is not a string.", constant);
+                    }
+                }
+                break;
+            case OP_FOR_TEST: {
+                uint8_t mode = code[offset + 2];
+                if(mode & ~(FOR_CMP_MASK | FOR_LIMIT_LOCAL)){
+                    return fail(*chunk, name, offset, error, "invalid loop mode %d.", mode);
+                }
+                if(!(mode & FOR_LIMIT_LOCAL)) constant = code[offset + 3];
+                break;
+            }
+            case OP_FOR_STEP:
+                if(code[offset + 2] & ~FOR_STEP_SUBTRACT){
+                    return fail(*chunk, name, offset, error, "invalid loop mode %d.", code[offset + 2]);
+                }
+                //run()直接把步长加到循环变量上，不检查类型
+                constant = code[offset + 3];
+                if(constant < constants && !IS_NUMBER(chunk->getConstant(constant))){
+                    return fail(*chunk, name, offset, error, "loop step %d is not a number.", constant);
+                }
+                break;
+            case OP_CASE_TABLE:
+                //散列表里查到的下标run()会再检查是否在表内
+                constant = chunk->getLong(offset + 3);
+                if(constant < constants){
+                    Value cases = chunk->getConstant(constant);
+                    if(!IS_OBJ(cases) || !IS_MAP(cases)){
+                        return fail(*chunk, name, offset, error, "case table %d is not a map.", constant);
+                    }
+                }
+                break;
+        }
+        if(constant >= constants){
+            return fail(*chunk, name, offset, error, "constant %d out of range (%d constants).", constant, constants);
+        }
+        if(isBranch(instruction) || isSwitch(instruction)) branches.push_back(offset);
+        offset += length;
+    }
+
+    std::vector<bool> isTarget(count, false);
+    for(int offset : branches){
+        bool table = isSwitch(code[offset]);
+        int targets = table ? switchCount(code, offset) + 1 : 1;
+        for(int entry = 0; entry < targets; entry++){
+            int target = table ? switchTarget(code, offset, entry) : branchTarget(code, offset);
+            if(target < 0 || target >= count || !boundary[target]){
+                return fail(*chunk, name, offset, error, "jump target %d is not an instruction.", target);
+            }
+            isTarget[target] = true;
+        }
+    }
+
+    //第二遍从入口沿所有路径推算栈深度。不是跳转目标的指令只能从上一条顺序执行到达，
+    //所以路径只在跳转目标处汇合，只需要在那里记录深度；其余部分顺着往下走，每条指令只走一次
+    std::unordered_map<int, int> targetDepth;
+    std::vector<std::pair<int, int>> worklist;      //(偏移, 进入时的深度)
+    int maxDepth = entryDepth;
+    auto merge = [&](int target, int depth, int from){
+        auto it = targetDepth.find(target);
+        if(it == targetDepth.end()){
+            targetDepth.emplace(target, depth);
+            worklist.push_back(std::make_pair(target, depth));
+            return true;
+        }
+        if(it->second == depth) return true;
+        return fail(*chunk, name, target, error, "stack depth %d does not match %d from offset %d.",
+                    it->second, depth, from);
+    };
+    if(isTarget[0]) targetDepth.emplace(0, entryDepth);
+    worklist.push_back(std::make_pair(0, entryDepth));
+    while(!worklist.empty()){
+        int offset = worklist.back().first;
+        int before = worklist.back().second;
+        worklist.pop_back();
+        for(;;){
+            uint8_t instruction = code[offset];
+            int length = instructionSize(code, offset);
+            int needed = 0;         //执行前栈上至少要有几个值
+            int after = before;
+            int slot = -1;          //读写的局部变量槽位
+            int limitSlot = -1;
+            bool fallsThrough = true;
+
+            //第一遍已经拒绝了不认识的操作码，这里再查一次，表的下标不会越界
+            if(instruction > OP_RETURN) return fail(*chunk, name, offset, error, "unknown opcode %d.", instruction);
+            StackEffect effect = stackEffects[instruction];
+            if(effect.needed != VARIABLE){
+                needed = effect.needed;
+                after = before + effect.effect;
+            }else{
+                switch(instruction){
+                    case OP_GET_LOCAL:
+                        slot = code[offset + 1];
+                        after = before + 1;
+                        break;
+                    case OP_SET_LOCAL:
+                        slot = code[offset + 1];
+                        needed = 1;
+                        break;
+                    case OP_JUMP:
+                    case OP_LOOP:
+                        fallsThrough = false;
+                        break;
+                    case OP_CALL:
+                        //返回值放在被调用者的位置上
+                        needed = code[offset + 1] + 1;
+                        after = before - code[offset + 1];
+                        break;
+                    case OP_MAP:
+                        needed = 2 * code[offset + 1];
+                        after = before - needed + 1;
+                        break;
+                    case OP_FOR_TEST:
+                        slot = code[offset + 1];
+                        if(code[offset + 2] & FOR_LIMIT_LOCAL) limitSlot = code[offset + 3];
+                        break;
+                    case OP_FOR_STEP:
+                        slot = code[offset + 1];
+                        fallsThrough = false;
+                        break;
+                    case OP_JUMP_TABLE:
+                    case OP_CASE_TABLE:
+                        //弹出分派的值，每个分支进入时的深度都一样
+                        needed = 1;
+                        after = before - 1;
+                        fallsThrough = false;
+                        break;
+                    case OP_RETURN:
+                        //函数返回时弹出返回值，顶层脚本结束时栈上可以有任何东西
+                        needed = entryDepth > 0 ? 1 : 0;
+                        fallsThrough = false;
+                        break;
+                }
+            }
+
+            if(before < needed){
+                return fail(*chunk, name, offset, error, "stack underflow (depth %d, needs %d).", before, needed);
+            }
+            if(slot >= before || limitSlot >= before){
+                return fail(*chunk, name, offset, error, "local slot %d out of range (depth %d).",
+                            slot >= before ? slot : limitSlot, before);
+            }
+            if(after > maxDepth) maxDepth = after;
+
+            if(isBranch(instruction) && !merge(branchTarget(code, offset), after, offset)) return false;
+            if(isSwitch(instruction)){
+                for(int entry = 0; entry <= switchCount(code, offset); entry++){
+                    if(!merge(switchTarget(code, offset, entry), after, offset)) return false;
+                }
+            }
+            if(!fallsThrough) break;
+            int next = offset + length;
+            if(next == count){
+                return fail(*chunk, name, offset, error, "execution runs past the end of the chunk.");
+            }
+            if(isTarget[next]){
+                if(!merge(next, after, offset)) return false;
+                break;
+            }
+            offset = next;
+            before = after;
+        }
+    }
+
+    chunk->setMaxStack(maxDepth);
+    return true;
+}
+
+//函数的chunk各自验证，进入时栈上是函数本身和参数。有一个函数不通过，外层也算没有验证
+static bool verifyTree(Chunk* chunk, const char* name, int entryDepth, std::string* error){
+    if(!verifyCode(chunk, name, entryDepth, error)) return false;
+    for(int i = 0; i < chunk->getConstantCount(); i++){
+        Value constant = chunk->getConstant(i);
+        if(!IS_OBJ(constant) || !IS_FUNCTION(constant)) continue;
+        ObjFunction* function = AS_FUNCTION(constant);
+        std::string functionName = function->m_name->m_string + "()";
+        if(!verifyTree(&function->m_chunk, functionName.c_str(), function->m_arity + 1, error)){
+            chunk->setMaxStack(-1);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool verifyChunk(Chunk* chunk, std::string* error){
+    return verifyTree(chunk, "script", 0, error);
+}
+
+bool verifyFunction(ObjFunction* function, std::string* error){
+    std::string name = function->m_name->m_string + "()";
+    return verifyCode(&function->m_chunk, name.c_str(), function->m_arity + 1, error);
+}
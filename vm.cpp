@@ -3,24 +3,45 @@
 //
 
 #include <stdarg.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <map>
 #include "vm.h"
 #include "debug.h"
 #include "value.h"
 #include "object.h"
 #include "compiler.h"
+#include "natives.h"
+#include "arrays.h"
+#include "hashmap.h"
+#include "verifier.h"
+#include "infer.h"
 
 VM::VM(){
     m_chunk = nullptr;
     m_ip = nullptr;
     m_objects = nullptr;
+    m_stack.resize(STACK_MAX);
+    m_stackTop = m_stack.data();
+    m_stackReserved = m_stackTop;
+    m_slots = m_stack.data();
+    memset(m_frames, 0, sizeof(m_frames));
+    m_frameCount = 0;
+    m_frameSeq = 0;
+    m_budgetEnd = BUDGET_UNLIMITED;
+    m_dumpOnError = false;
+    m_name = "script";
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_out = &std::cout;
+    m_err = &std::cerr;
+    defineNatives(this);
 }
 
 VM::~VM(){
     m_chunk = nullptr;
     m_ip = nullptr;
-    while(!m_stack.empty())
-        m_stack.pop();
-    freeObjects();
+    freeObjects(this);
     // if(!m_strings.empty()){
     //     for (auto it = m_strings.begin(); it != m_strings.end(); ++it) {
     //         delete it->second.as.obj; // 销毁 ObjString 对象
@@ -37,46 +58,102 @@ VM::~VM(){
 }
 
 void VM::resetStack(){
-    while(!m_stack.empty())
-        m_stack.pop();
-}
-
-void VM::printTop(){
-    printValue(m_stack.top());
+    m_stackTop = m_stack.data();
 }
 
 void VM::runtimeError(const char* format, ...) {
+    char message[1024];
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    vsnprintf(message, sizeof(message), format, args);
     va_end(args);
-    fputs("\n", stderr);
+    *m_err<<message<<"\n";
 
-    size_t instruction = m_ip - m_chunk->getFirstCode() - 1;
-    int line = m_chunk->getLine(instruction);
-    fprintf(stderr, "[line %d] in script\n", line);
+    //从最内层的帧开始逐帧输出调用栈
+    for(int i = m_frameCount - 1; i >= 0; i--){
+        CallFrame* frame = &m_frames[i];
+        uint8_t* ip = i == m_frameCount - 1 ? m_ip : frame->ip;
+        size_t instruction = ip - frame->chunk->getFirstCode() - 1;
+        int line = frame->chunk->getLine(instruction);
+        *m_err<<"[line "<<line<<"] in ";
+        if(frame->function == nullptr) *m_err<<"script"<<std::endl;
+        else *m_err<<frame->function->m_name->m_string<<"()"<<std::endl;
+    }
+    if(m_dumpOnError) m_recorder.dump(*m_err);
     resetStack();
 }
 
-Value VM::peek(int distance){
-    Value* stackTop;
-    stackTop = &m_stack.top();
-    return stackTop[-distance];
-}
-
 static bool isFalsey(Value value){
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+bool VM::call(ObjFunction* function, int argCount){
+    if(argCount != function->m_arity){
+        runtimeError("Expected %d arguments but got %d.", function->m_arity, argCount);
+        return false;
+    }
+    if(m_frameCount == FRAMES_MAX){
+        runtimeError("Stack overflow.");
+        return false;
+    }
+    //函数的chunk验证过，整帧用到的栈在进入时一次检查完，run()里压栈不再检查
+    Value* slots = m_stackTop - argCount - 1;
+    if(!reserveFrame(slots, function->m_chunk)){
+        runtimeError("Stack overflow.");
+        return false;
+    }
+    //被调用的函数和实参已经在栈上，直接成为新帧的槽位0..argCount
+    m_frames[m_frameCount - 1].ip = m_ip;
+    beginFrameSwitch();
+    CallFrame* frame = &m_frames[m_frameCount];
+    frame->function = function;
+    frame->chunk = &function->m_chunk;
+    frame->slots = slots;
+    m_frameCount++;
+    m_chunk = frame->chunk;
+    m_ip = m_chunk->getFirstCode();
+    m_slots = frame->slots;
+    endFrameSwitch();
+    return true;
+}
+
+bool VM::reserveFrame(Value* slots, const Chunk& chunk){
+    Value* reserved = slots + chunk.getMaxStack();
+    if(reserved > m_stack.data() + m_stack.size()) return false;
+    if(reserved > m_stackReserved) m_stackReserved = reserved;
+    return true;
+}
+
+bool VM::callValue(Value callee, int argCount){
+    if(IS_OBJ(callee)){
+        switch(OBJ_TYPE(callee)){
+            case OBJ_FUNCTION:
+                return call(AS_FUNCTION(callee), argCount);
+            case OBJ_NATIVE: {
+                Value result;
+                if(!callNative(this, AS_NATIVE(callee), argCount, m_stackTop - argCount, &result)){
+                    runtimeError("%s", AS_STRING(result)->m_string.c_str());
+                    return false;
+                }
+                m_stackTop -= argCount + 1;
+                push(result);
+                return true;
+            }
+            default:
+                break;
+        }
+    }
+    runtimeError("Can only call functions and classes.");
+    return false;
+}
+
 void VM::concatenate() {
-    ObjString* b = AS_STRING(m_stack.top());
-    m_stack.pop();
-    ObjString* a = AS_STRING(m_stack.top());
-    m_stack.pop();
-    std::string chars = a->m_string;
-    chars+=b->m_string;
-    ObjString* result = makeString(chars, chars.length());
-    m_stack.push(OBJ_VAL(result));
+    ObjString* b = AS_STRING(pop());
+    ObjString* a = AS_STRING(pop());
+    std::string chars(a->view());
+    chars+=b->view();
+    ObjString* result = makeString(this, chars, chars.length());
+    push(OBJ_VAL(result));
 }
 
 InterpretResult VM::run(){
@@ -85,108 +162,118 @@ InterpretResult VM::run(){
 #define READ_SHORT() \
     (m_ip += 2, (uint16_t)((m_ip[-2] << 8) | m_ip[-1]))
 #define READ_STRING() AS_STRING(READ_CONSTANT())
-#define BINARY_OP(valueType, op) \
+#define READ_LONG() \
+    (m_ip += 3, (m_ip[-3] << 16) | (m_ip[-2] << 8) | m_ip[-1])
+//单字节和_LONG形式共用一个case，按指令选择操作数宽度
+#define READ_NAME(shortForm) \
+    AS_STRING(m_chunk->getConstant(instruction == (shortForm) ? READ_BYTE() : READ_LONG()))
+#define BINARY_OP(op) \
         do{ \
             if(!IS_NUMBER(peek(0))|| !IS_NUMBER(peek(1))){ \
                 runtimeError("Operands must be numbers."); \
                 return INTERPRET_RUNTIME_ERROR; \
             } \
-            double b = AS_NUMBER(m_stack.top());  \
-            m_stack.pop();    \
-            double a = AS_NUMBER(m_stack.top());   \
-            m_stack.pop();    \
-            m_stack.push(NUMBER_VAL(a op b));   \
+            Value b = pop();  \
+            Value a = pop();  \
+            push(op(a, b));   \
+        }while(false)
+//_NUM操作码的操作数已在编译时证明是数字，原地计算
+#define NUMBER_OP(op) \
+        do{ \
+            m_stackTop[-2] = op(m_stackTop[-2], m_stackTop[-1]); \
+            m_stackTop--; \
         }while(false)
 
+    //飞行记录器每条指令都要用，提到循环外，调用和返回时更新
+    const uint8_t* code = m_chunk->getFirstCode();
+    const Value* stackBase = m_stack.data();
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-        std::stack<Value> out;
-    while(!m_stack.empty()){
-        out.push(m_stack.top());
-        m_stack.pop();
+    //和print一样写到本VM的输出流，--jobs并行时各脚本的跟踪不会混在一起
+    *m_out<<"           ";
+    for(Value* slot = m_stack.data(); slot < m_stackTop; slot++){
+        *m_out<<"[ ";
+        printValue(*slot, *m_out);
+        *m_out<<" ]";
     }
-    std::cout<<"           ";
-    while(!out.empty()){
-        std::cout<<"[ ";
-        printValue(out.top());
-        std::cout<<" ]";
-        m_stack.push(out.top());
-        out.pop();
-    }
-    std::cout<<std::endl;
+    *m_out<<std::endl;
     disassembleInstruction(*m_chunk,
-                           (int)(m_ip - m_chunk->getFirstCode()));
+                           (int)(m_ip - m_chunk->getFirstCode()), *m_out);
 #endif
+        if (m_stats.instructions == m_budgetEnd) return INTERPRET_YIELD;   //m_ip停在下一条指令
+        m_stats.instructions++;
+        m_recorder.record(m_chunk, (uint32_t)(m_ip - code), *m_ip,
+                          m_stackTop > stackBase ? m_stackTop[-1].type : RECORD_EMPTY);
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
             case OP_CONSTANT:{
                 Value constant = READ_CONSTANT();
-                m_stack.push(constant);
-                printValue(constant);
-                std::cout<<std::endl;
+                push(constant);
+#ifdef DEBUG_TRACE_EXECUTION
+                printValue(constant, *m_out);
+                *m_out<<std::endl;
+#endif
                 break;
             }
-            case OP_NIL: m_stack.push(NIL_VAL); break;
-            case OP_TRUE: m_stack.push(BOOL_VAL(true)); break;
-            case OP_FALSE: m_stack.push(BOOL_VAL(false)); break;
-            case OP_POP: m_stack.pop(); break;
+            case OP_CONSTANT_LONG: push(m_chunk->getConstant(READ_LONG())); break;
+            case OP_NIL: push(NIL_VAL); break;
+            case OP_TRUE: push(BOOL_VAL(true)); break;
+            case OP_FALSE: push(BOOL_VAL(false)); break;
+            case OP_POP: pop(); break;
             case OP_GET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                m_stack.push(getStack(slot)); 
+                push(m_slots[slot]);
                 break;
             }
             case OP_SET_LOCAL: {
                 uint8_t slot = READ_BYTE();
-                setStack(slot, peek(0));
+                m_slots[slot] = peek(0);
                 break;
             }
-            case OP_GET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!m_globals.count(name->m_string)) {
-                    runtimeError("Undefined variable '%s'.", name->m_string);
+            case OP_GET_GLOBAL:
+            case OP_GET_GLOBAL_LONG: {
+                ObjString* name = READ_NAME(OP_GET_GLOBAL);
+                auto it = m_globals.find(name->m_string);
+                if (it == m_globals.end()) {
+                    runtimeError("Undefined variable '%s'.", name->m_string.c_str());
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                value = m_globals.find(name->m_string)->second;
-                m_stack.push(value);
+                push(it->second);
                 break;
             }
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                m_globals.emplace(name->m_string, peek(0));
-                m_stack.pop();
+            case OP_DEFINE_GLOBAL:
+            case OP_DEFINE_GLOBAL_LONG: {
+                ObjString* name = READ_NAME(OP_DEFINE_GLOBAL);
+                m_globals[name->m_string] = pop();    //重复定义覆盖旧值
                 break;
             }
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                if (!m_globals.count(name->m_string)) {
-                    runtimeError("Undefined variable '%s'.", name->m_string);
+            case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_LONG: {
+                ObjString* name = READ_NAME(OP_SET_GLOBAL);
+                auto it = m_globals.find(name->m_string);
+                if (it == m_globals.end()) {
+                    runtimeError("Undefined variable '%s'.", name->m_string.c_str());
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                m_globals.erase(name->m_string);
-                m_globals.emplace(name->m_string, peek(0));
+                it->second = peek(0);
                 break;
             }
             case OP_EQUAL: {
-                Value b = m_stack.top();
-                m_stack.pop();
-                Value a = m_stack.top();
-                m_stack.pop();
-                m_stack.push(BOOL_VAL(valuesEqual(a, b)));
+                Value b = pop();
+                Value a = pop();
+                push(BOOL_VAL(valuesEqual(a, b)));
                 break;
             }
-            case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
+            case OP_GREATER:  BINARY_OP(numberGreater); break;
+            case OP_LESS:     BINARY_OP(numberLess); break;
             case OP_ADD: {
-                if (IS_OBJ(peek(0)) && IS_OBJ(peek(1))) {
-                    if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
-                        concatenate();
+                if (IS_OBJ(peek(0)) && IS_OBJ(peek(1)) &&
+                    IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                    concatenate();
                 } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                    double b = AS_NUMBER(m_stack.top());
-                    m_stack.pop();
-                    double a = AS_NUMBER(m_stack.top());
-                    m_stack.pop();
-                    m_stack.push(NUMBER_VAL(a + b));
+                    Value b = pop();
+                    Value a = pop();
+                    push(numberAdd(a, b));
                 } else {
                     runtimeError(
                             "Operands must be two numbers or two strings.");
@@ -194,13 +281,11 @@ InterpretResult VM::run(){
                 }
                 break;
             }
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
+            case OP_SUBTRACT: BINARY_OP(numberSubtract); break;
+            case OP_MULTIPLY: BINARY_OP(numberMultiply); break;
+            case OP_DIVIDE:   BINARY_OP(numberDivide); break;
             case OP_NOT:{
-                Value b = BOOL_VAL(isFalsey(m_stack.top()));
-                m_stack.pop();
-                m_stack.push(b);
+                push(BOOL_VAL(isFalsey(pop())));
                 break;
             }
             case OP_NEGATE: {
@@ -208,15 +293,20 @@ InterpretResult VM::run(){
                     runtimeError("Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                Value tmp = m_stack.top();
-                m_stack.pop();
-                m_stack.push(NUMBER_VAL(-AS_NUMBER(tmp)));
+                Value tmp = pop();
+                push(numberNegate(tmp));
                 break;
             }
+            case OP_GREATER_NUM:  NUMBER_OP(numberGreater); break;
+            case OP_LESS_NUM:     NUMBER_OP(numberLess); break;
+            case OP_ADD_NUM:      NUMBER_OP(numberAdd); break;
+            case OP_SUBTRACT_NUM: NUMBER_OP(numberSubtract); break;
+            case OP_MULTIPLY_NUM: NUMBER_OP(numberMultiply); break;
+            case OP_DIVIDE_NUM:   NUMBER_OP(numberDivide); break;
+            case OP_NEGATE_NUM:   m_stackTop[-1] = numberNegate(m_stackTop[-1]); break;
             case OP_PRINT: {
-                printValue(m_stack.top());
-                m_stack.pop();
-                std::cout<< std::endl;
+                printValue(pop(), *m_out);
+                *m_out<< std::endl;
                 break;
             }
             case OP_JUMP: {
@@ -234,9 +324,170 @@ InterpretResult VM::run(){
                 m_ip -= offset;
                 break;
             }
+            case OP_CALL: {
+                int argCount = READ_BYTE();
+                if (!callValue(peek(argCount), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                code = m_chunk->getFirstCode();
+                break;
+            }
+            case OP_GET_INDEX: {
+                if (IS_OBJ(peek(1)) && IS_MAP(peek(1))) {
+                    Value value;
+                    if (!AS_MAP(peek(1))->get(peek(0), &value)) value = NIL_VAL;   //没有的键读出nil
+                    m_stackTop[-2] = value;
+                    m_stackTop--;
+                    break;
+                }
+                size_t slot;
+                const char* message = arraySlot(peek(1), peek(0), &slot);
+                if (message != nullptr) {
+                    runtimeError("%s", message);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                m_stackTop[-2] = NUMBER_VAL(AS_ARRAY(peek(1))->m_values[slot]);
+                m_stackTop--;
+                break;
+            }
+            case OP_SET_INDEX: {
+                if (IS_OBJ(peek(2)) && IS_MAP(peek(2))) {
+                    const char* message = mapKeyError(peek(1));
+                    if (message != nullptr) {
+                        runtimeError("%s", message);
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    mapSet(this, AS_MAP(peek(2)), peek(1), peek(0));
+                    m_stackTop[-3] = peek(0);
+                    m_stackTop -= 2;
+                    break;
+                }
+                size_t slot;
+                const char* message = arraySlot(peek(2), peek(1), &slot);
+                if (message != nullptr) {
+                    runtimeError("%s", message);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (!IS_NUMBER(peek(0))) {
+                    runtimeError("Array elements must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                AS_ARRAY(peek(2))->m_values[slot] = AS_NUMBER(peek(0));
+                m_stackTop[-3] = peek(0);
+                m_stackTop -= 2;
+                break;
+            }
+            case OP_MAP: {
+                int count = READ_BYTE();
+                Value* entries = m_stackTop - 2 * count;
+                ObjMap* map = (ObjMap*)allocateObj(this, OBJ_MAP);
+                for (int i = 0; i < count; i++) {
+                    const char* message = mapKeyError(entries[2 * i]);
+                    if (message != nullptr) {
+                        runtimeError("%s", message);
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    mapSet(this, map, entries[2 * i], entries[2 * i + 1]);
+                }
+                m_stackTop = entries;
+                push(OBJ_VAL(map));
+                break;
+            }
+            case OP_IN: {
+                if (!IS_OBJ(peek(0)) || !IS_MAP(peek(0))) {
+                    runtimeError("Right operand of 'in' must be a map.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                Value value;
+                bool found = AS_MAP(peek(0))->get(peek(1), &value);
+                m_stackTop[-2] = BOOL_VAL(found);
+                m_stackTop--;
+                break;
+            }
+            case OP_DELETE: {
+                if (!IS_OBJ(peek(1)) || !IS_MAP(peek(1))) {
+                    runtimeError("Can only delete entries from a map.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                AS_MAP(peek(1))->remove(peek(0));
+                m_stackTop -= 2;
+                break;
+            }
+            case OP_FOR_TEST: {
+                uint8_t slot = READ_BYTE();
+                uint8_t mode = READ_BYTE();
+                uint8_t limitArg = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                Value a = m_slots[slot];
+                Value b = (mode & FOR_LIMIT_LOCAL) ? m_slots[limitArg] : m_chunk->getConstant(limitArg);
+                if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                    runtimeError("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                //<= 和 >= 与普通形式一样按 !(a > b)、!(a < b) 求值，NaN时结果一致
+                bool inLoop;
+                switch (mode & FOR_CMP_MASK) {
+                    case FOR_CMP_LESS:          inLoop = AS_BOOL(numberLess(a, b)); break;
+                    case FOR_CMP_LESS_EQUAL:    inLoop = !AS_BOOL(numberGreater(a, b)); break;
+                    case FOR_CMP_GREATER:       inLoop = AS_BOOL(numberGreater(a, b)); break;
+                    default:                    inLoop = !AS_BOOL(numberLess(a, b)); break;
+                }
+                if (!inLoop) m_ip += offset;
+                break;
+            }
+            case OP_FOR_STEP: {
+                uint8_t slot = READ_BYTE();
+                uint8_t mode = READ_BYTE();
+                Value step = READ_CONSTANT();
+                uint16_t offset = READ_SHORT();
+                if (!IS_NUMBER(m_slots[slot])) {
+                    //和不融合时OP_ADD、OP_SUBTRACT的提示一样
+                    runtimeError((mode & FOR_STEP_SUBTRACT) ? "Operands must be numbers." :
+                                 "Operands must be two numbers or two strings.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                m_slots[slot] = numberAdd(m_slots[slot], step);
+                m_ip -= offset;
+                break;
+            }
+            case OP_JUMP_TABLE: {
+                int count = READ_SHORT();
+                int32_t low = (int32_t)(((uint32_t)m_ip[0] << 24) | (m_ip[1] << 16) | (m_ip[2] << 8) | m_ip[3]);
+                uint8_t* table = m_ip + 4;
+                m_ip = table + 2 * (count + 1);     //跳转表项是从这里往回的距离
+                int32_t value;
+                int64_t entry = caseInteger(pop(), &value) ? (int64_t)value - low : count;
+                if(entry < 0 || entry > count) entry = count;
+                m_ip -= (table[2 * entry] << 8) | table[2 * entry + 1];
+                break;
+            }
+            case OP_CASE_TABLE: {
+                int count = READ_SHORT();
+                ObjMap* cases = AS_MAP(m_chunk->getConstant(READ_LONG()));
+                uint8_t* table = m_ip;
+                m_ip = table + 2 * (count + 1);
+                Value found;
+                int entry = count;
+                if(cases->get(pop(), &found) && IS_INT(found) && (uint32_t)AS_INT(found) < (uint32_t)count){
+                    entry = AS_INT(found);
+                }
+                m_ip -= (table[2 * entry] << 8) | table[2 * entry + 1];
+                break;
+            }
             case OP_RETURN: {
-                // Exit interpreter.
-                return INTERPRET_OK;
+                if (m_frameCount == 1) return INTERPRET_OK;    //顶层脚本结束，栈上没有返回值
+                Value result = pop();
+                m_stackTop = m_slots;       //丢掉整个帧，包括槽位0上的函数
+                beginFrameSwitch();
+                m_frameCount--;
+                CallFrame* frame = &m_frames[m_frameCount - 1];
+                m_chunk = frame->chunk;
+                m_ip = frame->ip;
+                m_slots = frame->slots;
+                endFrameSwitch();
+                code = m_chunk->getFirstCode();
+                push(result);
+                break;
             }
         }
     }
@@ -245,63 +496,273 @@ InterpretResult VM::run(){
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_LONG
+#undef READ_NAME
 #undef BINARY_OP
+#undef NUMBER_OP
 }
 
-int VM::countString(const char* s){
-    std::string str = s;
-    return m_strings.count(s);
+ObjString* VM::findString(const char* chars, size_t length, uint32_t hash){
+    auto it = m_strings.find(StringKey{std::string_view(chars, length), hash});
+    if(it == m_strings.end()) return nullptr;
+    return it->second;
 }
 
-void VM::insertString(const char* s, Value value){
-    std::string str = s;
-    m_strings.emplace(str, value);
+void VM::insertString(ObjString* string){
+    m_strings.emplace(StringKey{std::string_view(string->m_string), string->m_hash}, string);
 }
 
-Value VM::getString(const char* s){
-    std::string str = s;
-    auto it = m_strings.find(s);
-    return it->second;
+void VM::changeObjects(Obj* object){
+    m_objects = object;
 }
 
-Value VM::getStack(uint8_t index){
-    Value* stackBottom;
-    int size = m_stack.size();
-    Value* stackTop;
-    stackTop = &m_stack.top();
-    stackBottom = &stackTop[-size+1];
-    return stackBottom[index];
+Obj* VM::getObjects(){
+    return m_objects;
 }
 
-void VM::setStack(uint8_t index, Value value){
-    Value* stackBottom;
-    int size = m_stack.size();
-    Value* stackTop;
-    stackTop = &m_stack.top();
-    stackBottom = &stackTop[-size+1];
-    stackBottom[index] = value;
+ObjPool& VM::getPool(){
+    return m_pool;
 }
 
-void VM::changeObjects(Obj* object){
-    m_objects = object;
+void VM::setOutput(std::ostream& out, std::ostream& err){
+    m_out = &out;
+    m_err = &err;
 }
 
-Obj* VM::getObjects(){
-    return m_objects;
+std::ostream& VM::out(){
+    return *m_out;
+}
+
+std::ostream& VM::err(){
+    return *m_err;
 }
 
 InterpretResult VM::interpret(const std::string& source){
+    return interpret(source.data(), source.size());
+}
+
+InterpretResult VM::interpret(const char* source, size_t length){
     Chunk chunk;
-    Compiler compiler(source, &chunk);
-    //创建空的chunk，传给编译器，编译器来填充
-    if(!compiler.compile()){
+    if(!compile(source, length, &chunk)){
         return INTERPRET_COMPILE_ERROR;
     }
+    return interpret(chunk);
+}
 
+InterpretResult VM::compile(const std::string& source, Script* script){
+    std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+    if(!compile(source.data(), source.size(), chunk.get())){
+        return INTERPRET_COMPILE_ERROR;
+    }
+    chunk->freeze();
+    *script = Script(chunk);
+    return INTERPRET_OK;
+}
+
+InterpretResult VM::execute(const Script& script, uint64_t budget){
+    if(!script.isValid()) return INTERPRET_COMPILE_ERROR;
+    if(!load(script.getChunk())) return INTERPRET_COMPILE_ERROR;
+    m_running = script;
+    return resume(budget);
+}
+
+void VM::setGlobal(const std::string& name, Value value){
+    m_globals[name] = value;
+}
+
+bool VM::getGlobal(const std::string& name, Value* value){
+    auto it = m_globals.find(name);
+    if(it == m_globals.end()) return false;
+    *value = it->second;
+    return true;
+}
+
+Value VM::newString(const std::string& s){
+    return OBJ_VAL(makeString(this, s, (int)s.size()));
+}
+
+static ObjNative* newNative(VM* vm, const std::string& name, NativeKind kind, int arity){
+    ObjNative* native = (ObjNative*)allocateObj(vm, OBJ_NATIVE);
+    native->m_name = name;
+    native->m_kind = kind;
+    native->m_arity = arity;
+    return native;
+}
+
+void VM::defineNative(const std::string& name, int arity, NativeFn function){
+    ObjNative* native = newNative(this, name, NATIVE_GENERIC, arity);
+    native->as.function = function;
+    m_globals[name] = OBJ_VAL(native);
+}
+
+void VM::defineNative(const std::string& name, NativeNumber1 function){
+    ObjNative* native = newNative(this, name, NATIVE_NUMBER1, 1);
+    native->as.number1 = function;
+    m_globals[name] = OBJ_VAL(native);
+}
+
+void VM::defineNative(const std::string& name, NativeNumber2 function){
+    ObjNative* native = newNative(this, name, NATIVE_NUMBER2, 2);
+    native->as.number2 = function;
+    m_globals[name] = OBJ_VAL(native);
+}
+
+VMStats VM::getStats(){
+    VMStats stats = m_stats;
+    stats.reservedStack = m_stackReserved - m_stack.data();
+    stats.internedStrings = m_strings.size();
+    return stats;
+}
+
+//在SIGPROF处理函数里调用，只读VM的状态、写预先分配好的m_profile。
+//处理函数和解释器在同一个线程上，运行期间切换不会往下走：m_frameSeq是奇数说明打断在
+//一次调用或返回的中途，m_chunk、m_ip和帧数可能对不上，丢掉这个样本。
+//是偶数时三者是同一次切换写下的；m_ip之后可能还在寄存器里没写回，行号会落后几条指令，但不会出这个chunk
+void VM::takeSample(){
+    if(m_frameSeq & 1) return;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    int depth = m_frameCount;
+    if(m_chunk == nullptr || depth == 0) return;
+    size_t offset = m_ip - m_chunk->getFirstCode();
+    if(offset >= (size_t)m_chunk->getCount()) return;
+
+    ProfileSample sample;
+    sample.chunk = m_chunk;
+    sample.line = m_chunk->getLine((int)offset);
+    sample.depth = depth;
+    uint64_t hash = (uintptr_t)sample.chunk ^ (uint64_t)sample.line;
+    int frames = depth < PROFILE_DEPTH ? depth : PROFILE_DEPTH;
+    for(int i = 0; i < frames; i++){
+        sample.frames[i] = m_frames[depth - 1 - i].function;
+        hash = hash * 31 + (uintptr_t)sample.frames[i];
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    sample.hash = hash;
+    m_profile.add(sample);
+}
+
+//把样本折叠成"根;函数;...;line N"的文本，合并进全进程的分析结果。
+//样本里有chunk和函数的指针，只能在脚本结束前做
+void VM::foldProfile(){
+    std::map<std::string, uint64_t> stacks;
+    for(const ProfileSample& sample : m_profile.slots()){
+        if(sample.count == 0) continue;
+        std::string stack = m_name;
+        if(sample.depth > PROFILE_DEPTH) stack += ";...";
+        int frames = sample.depth < PROFILE_DEPTH ? sample.depth : PROFILE_DEPTH;
+        for(int i = frames - 1; i >= 0; i--){
+            if(sample.frames[i] == nullptr) continue;   //顶层脚本就是根帧
+            stack += ";";
+            stack += sample.frames[i]->m_name->m_string;
+        }
+        stack += ";line " + std::to_string(sample.line);
+        stacks[stack] += sample.count;
+    }
+    for(auto& stack : stacks){
+        profilerAddSamples(stack.first, stack.second);
+    }
+    if(m_profile.dropped() != 0) profilerAddDropped(m_profile.dropped());
+    m_profile.clear();
+}
+
+void VM::setName(const std::string& name){
+    m_name = name;
+}
+
+void VM::setDumpOnError(bool dump){
+    m_dumpOnError = dump;
+}
+
+void VM::dumpFlightRecorder(std::ostream& out){
+    if(m_chunk == nullptr){
+        out<<"== flight recorder: no script is running =="<<std::endl;
+        return;
+    }
+    m_recorder.dump(out);
+}
+
+bool VM::compile(const char* source, size_t length, Chunk* chunk){
+    //创建空的chunk，传给编译器，编译器来填充
+    auto start = std::chrono::steady_clock::now();
+    Compiler compiler(this, source, length, chunk);
+    bool ok = compiler.compile();
+    std::string error;
+    if(ok && !verifyChunk(chunk, &error)){
+        *m_err<<error<<std::endl;
+        ok = false;
+    }
+    if(ok) specializeNumbers(chunk);
+    m_stats.compileNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    m_stats.chunkBytes = chunk->getCount();
+    m_stats.constants = chunk->getConstantCount();
+    return ok;
+}
+
+//开始执行新的chunk，之前暂停的脚本直接丢弃。
+//run()不检查字节码，没有经过verifyChunk的chunk不执行
+bool VM::load(const Chunk& chunk){
+    resetStack();
+    m_running = Script();
+    m_recorder.clear();
+    m_profile.clear();      //被丢弃的暂停脚本的样本也不要了
+    m_chunk = nullptr;
+    m_frameCount = 0;
+    if(!chunk.isVerified()){
+        *m_err<<"Chunk has not been verified."<<std::endl;
+        return false;
+    }
+    if(!reserveFrame(m_stack.data(), chunk)){
+        *m_err<<"Stack overflow."<<std::endl;
+        return false;
+    }
+    beginFrameSwitch();
     m_chunk = &chunk;
     m_ip = m_chunk->getFirstCode();
+    m_slots = m_stack.data();
+    m_frames[0].function = nullptr;
+    m_frames[0].chunk = m_chunk;
+    m_frames[0].ip = nullptr;
+    m_frames[0].slots = m_slots;
+    m_frameCount = 1;
+    endFrameSwitch();
+    return true;
+}
+
+//run()只读chunk，冻结的chunk里没有指向其他VM堆的指针，
+//所以同一个chunk可以同时在多个线程的VM上执行
+InterpretResult VM::interpret(const Chunk& chunk, uint64_t budget){
+    if(!load(chunk)) return INTERPRET_COMPILE_ERROR;
+    return resume(budget);
+}
 
+//暂停时的全部状态就是调用帧、m_ip和值栈，run()直接从m_ip接着执行
+InterpretResult VM::resume(uint64_t budget){
+    if(m_chunk == nullptr) return INTERPRET_OK;
+    m_budgetEnd = budget > BUDGET_UNLIMITED - m_stats.instructions ?
+                  BUDGET_UNLIMITED : m_stats.instructions + budget;
+
+    //采样只在run()期间登记，暂停的脚本不会被采到
+    bool profiling = profilerRunning();
+    if(profiling){
+        m_profile.reserve();
+        profilerEnter(this);
+    }
+    auto start = std::chrono::steady_clock::now();
     InterpretResult result = run();
+    m_stats.executeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    if(profiling) profilerLeave();
+    if(result == INTERPRET_YIELD) return result;
+
+    foldProfile();
     resetStack();
-    return INTERPRET_OK;
+    m_chunk = nullptr;
+    m_ip = nullptr;
+    m_slots = m_stack.data();
+    m_frameCount = 0;
+    m_running = Script();
+    return result;
 }
\ No newline at end of file